@@ -0,0 +1,81 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "ring_buffer.h"
+
+// Fixed set of receive buffers recycled between the receive stage (acquire)
+// and the parse stage (release). The free list is itself an SPSC ring: the
+// parse thread produces freed buffers and the receive thread consumes them.
+//
+// The buffers are carved out of one anonymous mapping that is only reserved
+// up front, so a 64 KiB buffer that only ever holds a 200-byte datagram costs
+// one resident page, not sixteen.
+class BufferPool
+{
+public:
+    BufferPool(size_t buffer_size, size_t count)
+        : buffer_size(round_to_page(buffer_size)), count(count), capacity(buffer_size), free_list(count)
+    {
+        region = static_cast<char *>(mmap(nullptr, this->buffer_size * count, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+        if (region == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            release(region + i * this->buffer_size);
+        }
+    }
+
+    ~BufferPool()
+    {
+        munmap(region, buffer_size * count);
+    }
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // Receive thread only. Returns nullptr when every buffer is in flight.
+    char *acquire()
+    {
+        char **slot = free_list.front();
+        if (slot == nullptr)
+        {
+            return nullptr;
+        }
+        char *buffer = *slot;
+        free_list.pop();
+        return buffer;
+    }
+
+    // Parse thread only
+    void release(char *buffer)
+    {
+        char **slot = free_list.claim();
+        *slot = buffer; // Never full: there are only count buffers
+        free_list.publish();
+    }
+
+    // Usable bytes per buffer (the size asked for, not the page-rounded one)
+    size_t bufferSize() const { return capacity; }
+
+private:
+    size_t buffer_size;
+    size_t count;
+    size_t capacity;
+    char *region;
+    SpscRing<char *> free_list;
+
+    static size_t round_to_page(size_t size)
+    {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return (size + page - 1) / page * page;
+    }
+};
+
+#endif
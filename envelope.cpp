@@ -0,0 +1,133 @@
+#include "envelope.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+
+using namespace std;
+
+static const char FRAME_MAGIC[Envelope::FRAME_MAGIC_SIZE] = {'U', 'R', 'E', 'C'};
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// End of the JSON value starting at p, found by tracking nesting and string
+// state only. Returns end if the value never closes.
+static const char *value_end(const char *p, const char *end)
+{
+    if (*p != '{' && *p != '[')
+    {
+        while (p < end && !is_space(*p))
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    int depth = 0;
+    bool in_string = false;
+    for (; p < end; ++p)
+    {
+        char c = *p;
+        if (in_string)
+        {
+            if (c == '\\')
+            {
+                ++p;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+            }
+        }
+        else if (c == '"')
+        {
+            in_string = true;
+        }
+        else if (c == '{' || c == '[')
+        {
+            ++depth;
+        }
+        else if (c == '}' || c == ']')
+        {
+            if (--depth == 0)
+            {
+                return p + 1;
+            }
+        }
+    }
+    return end;
+}
+
+bool Envelope::isFramed(const char *data, size_t length)
+{
+    return length >= FRAME_MAGIC_SIZE && memcmp(data, FRAME_MAGIC, FRAME_MAGIC_SIZE) == 0;
+}
+
+bool Envelope::split(const char *data, size_t length, vector<string_view> &records)
+{
+    const char *p = data;
+    const char *end = data + length;
+
+    if (isFramed(data, length))
+    {
+        p += FRAME_MAGIC_SIZE;
+        while (p < end)
+        {
+            uint32_t size;
+            if (static_cast<size_t>(end - p) < FRAME_HEADER_SIZE)
+            {
+                records.emplace_back(p, end - p);
+                return false;
+            }
+            memcpy(&size, p, sizeof(size));
+            size = ntohl(size);
+            p += FRAME_HEADER_SIZE;
+            if (size > static_cast<size_t>(end - p))
+            {
+                records.emplace_back(p, end - p);
+                return false;
+            }
+            records.emplace_back(p, size);
+            p += size;
+        }
+        return true;
+    }
+
+    size_t found = 0;
+    while (true)
+    {
+        while (p < end && is_space(*p))
+        {
+            ++p;
+        }
+        if (p >= end)
+        {
+            break;
+        }
+        const char *next = value_end(p, end);
+        records.emplace_back(p, next - p);
+        found++;
+        p = next;
+    }
+
+    // An empty or all-whitespace datagram still goes to the parser, which reports it
+    if (found == 0)
+    {
+        records.emplace_back(data, length);
+    }
+    return true;
+}
+
+void Envelope::beginFramed(string &out)
+{
+    out.append(FRAME_MAGIC, FRAME_MAGIC_SIZE);
+}
+
+void Envelope::appendFrame(string &out, string_view record)
+{
+    uint32_t size = htonl(static_cast<uint32_t>(record.size()));
+    out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    out.append(record.data(), record.size());
+}
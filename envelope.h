@@ -0,0 +1,37 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A datagram (or reassembled message) can carry more than one record:
+//
+//  - Plain: one or more JSON objects back to back, separated by whitespace.
+//    This covers a single object (pretty-printed or not) as well as NDJSON.
+//  - Framed: the 4 bytes "UREC" followed by frames, each a big-endian uint32
+//    length and that many bytes of JSON.
+//
+// Splitting never copies: the slices point into the receive buffer.
+class Envelope
+{
+public:
+    static const size_t FRAME_MAGIC_SIZE = 4;
+    static const size_t FRAME_HEADER_SIZE = 4;
+
+    // Appends one slice per record to records (which is not cleared).
+    // Returns false if the envelope was malformed; slices found before the
+    // problem are still appended, and the unparsable remainder is appended
+    // as a final slice so the caller can report it.
+    static bool split(const char *data, size_t length, std::vector<std::string_view> &records);
+
+    static bool isFramed(const char *data, size_t length);
+
+    // Builders used by the sender
+    static void beginFramed(std::string &out);
+    static void appendFrame(std::string &out, std::string_view record);
+};
+
+#endif
@@ -1,436 +1,440 @@
-#include <hpdf.h>
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <vector>
+#include <filesystem>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <functional>
+#include <unistd.h>
 #include <nlohmann/json.hpp> // nlohmann/json header
+#include "pdf_document.h"
+#include "record_file.h"
+#include "string_interner.h"
+#include "write_ahead_log.h"
 
 using json = nlohmann::json; // Using alias for convenience
 using namespace std;
 
-class TextWrapper
+// Reads one record per line; torn or unparsable lines are skipped with a warning
+void parseNdjsonFile(const string &filename, json &jsonData)
 {
-public:
-    static vector<string> wrapText(const string &text, HPDF_Font font, float font_size, float cell_width, HPDF_Page page)
-    {
-        vector<string> lines;
-        string current_line = "";
-        HPDF_Page_SetFontAndSize(page, font, font_size);
-
-        // Width of a single character (using a common character for approximation, e.g., 'W')
-        float char_width = HPDF_Page_TextWidth(page, "W") / 1.0f;
-
-        istringstream remaining_text(text);
-        string word;
-
-        while (remaining_text >> word)
+    uint64_t skipped = 0;
+    bool ok = WriteAheadLog::readSegment(filename, [&](const char *line, size_t length)
+                                         {
+        json entry = json::parse(line, line + length, nullptr, false);
+        if (entry.is_discarded())
         {
-            string test_line = current_line.empty() ? word : current_line + " " + word;
-
-            // If the current line + word fits in the cell width, add the word
-            if (HPDF_Page_TextWidth(page, test_line.c_str()) <= cell_width)
-            {
-
-                current_line = test_line;
-            }
-            else
-            {
-                // Push the current line to the lines vector if it's not empty
-                if (!current_line.empty())
-                {
-                    lines.push_back(current_line);
-                }
-
-                // Handle the case where the word does not fit
-                while (!word.empty())
-                {
-                    // Calculate the number of characters that can fit in the cell width
-                    size_t chars_to_fit = static_cast<size_t>(cell_width / 5);
-
-                    // Check if the entire word can fit
-                    string part = word.substr(0, chars_to_fit);
-
-                    // If part exceeds the cell width, split it character by character
-                    while (HPDF_Page_TextWidth(page, part.c_str()) > cell_width && !part.empty())
-                    {
-                        part.erase(part.end() - 1); // Remove last character until it fits
-                    }
-
-                    // Add the part to lines and adjust the word accordingly
-                    lines.push_back(part);
-                    word.erase(0, part.length()); // Remove the used part from the word
-                    current_line.clear();         // Clear current_line for the next iteration
-                }
-            }
+            skipped++;
         }
-
-        // If there are any remaining words in the current line, push it to lines
-        if (!current_line.empty())
+        else
         {
-            lines.push_back(current_line);
-        }
-
-        return lines;
+            jsonData.push_back(move(entry));
+        } }, skipped);
+    if (!ok)
+    {
+        throw runtime_error("Could not read NDJSON file: " + filename);
     }
-};
+    if (skipped > 0)
+    {
+        cerr << "Warning: skipped " << skipped << " incomplete line(s) in " << filename << endl;
+    }
+}
 
-class PDFDocument
+// Accepts a JSON array, an NDJSON file, or a server WAL directory (all of
+// its segments, shard by shard)
+void parseJsonFile(const string &filename, json &jsonData)
 {
-public:
-    PDFDocument(const string &filename)
-        : pdf_filename(filename), pdf(HPDF_New(error_handler, nullptr)), current_y_position(0.0f), page_number(1)
+    jsonData = json::array();
+    if (filesystem::is_directory(filename))
     {
-        if (pdf == nullptr)
+        for (const auto &segment : WriteAheadLog::listSegments(filename))
         {
-            throw runtime_error("Failed to create PDF object.");
+            parseNdjsonFile(segment.path, jsonData);
         }
-        addNewPage();
+        return;
     }
 
-    ~PDFDocument()
+    ifstream file(filename);
+    if (!file.is_open())
     {
-        HPDF_Free(pdf);
+        throw runtime_error("Could not open JSON file: " + filename);
     }
-
-    void generatePDF(const json &jsonData)
+    file >> ws;
+    if (file.peek() == '[')
     {
-        loadImagesAndText();
-        for (const auto &entry : jsonData)
-        {
-            drawTableForEntry(entry);
-        }
-
-        HPDF_SaveToFile(pdf, pdf_filename.c_str());
+        file >> jsonData;
     }
+    else
+    {
+        file.close();
+        parseNdjsonFile(filename, jsonData);
+    }
+}
 
-private:
-    HPDF_Doc pdf;
-    HPDF_Page page;
-    HPDF_Font font;
-    string pdf_filename;
-    float font_size = 12.0f;
-    float margin = 50.0f;
-    float line_height = 18.0f;
-    float cell_padding = 10.0f; // Increased padding
-    float key_col_width;
-    float value_col_width;
-    float current_y_position;
-    int page_number;
+// Streaming counterparts of the above: records are handed to visit one at a
+// time and only the current one is kept
 
-    static void error_handler(HPDF_STATUS error_no, HPDF_STATUS detail_no, void *user_data)
+void streamNdjsonFile(const string &filename, const function<void(const Record &)> &visit, bool warn)
+{
+    RecordParser parser;
+    Arena arena;
+    uint64_t skipped = 0;
+    bool ok = WriteAheadLog::readSegment(filename, [&](const char *line, size_t length)
+                                         {
+        Arena::Mark mark = arena.mark();
+        Record record;
+        if (!parser.parse(line, length, arena, record))
+        {
+            json entry = json::parse(line, line + length, nullptr, false);
+            if (entry.is_discarded())
+            {
+                skipped++;
+                return;
+            }
+            Record::fromJson(entry, arena, record); // Non-objects give an empty record
+        }
+        visit(record);
+        arena.rewind(mark); }, skipped);
+    if (!ok)
     {
-        cerr << "ERROR: " << error_no << ", DETAIL: " << detail_no << endl;
+        throw runtime_error("Could not read NDJSON file: " + filename);
     }
-
-    void addNewPage()
+    if (warn && skipped > 0)
     {
-        page = HPDF_AddPage(pdf);
-        HPDF_Page_SetSize(page, HPDF_PAGE_SIZE_A4, HPDF_PAGE_PORTRAIT);
-        font = HPDF_GetFont(pdf, "Helvetica", nullptr);
-        HPDF_Page_SetFontAndSize(page, font, font_size);
-
-        float page_height = HPDF_Page_GetHeight(page);
-        current_y_position = page_height - margin; // Reset Y position
-
-        float page_width = HPDF_Page_GetWidth(page);
-        key_col_width = (page_width - 2 * margin) * 0.2f;
-        value_col_width = (page_width - 2 * margin) * 0.8f;
-
-        drawPageBorder();
-        drawPageNumber();
+        cerr << "Warning: skipped " << skipped << " incomplete line(s) in " << filename << endl;
     }
+}
 
-    void drawPageBorder()
-    {
-        float page_width = HPDF_Page_GetWidth(page);
-        float page_height = HPDF_Page_GetHeight(page);
+bool isRecordFile(const string &filename)
+{
+    return !filesystem::is_directory(filename) && RecordFile::detect(filename);
+}
 
-        HPDF_Page_SetLineWidth(page, 2.0f);
-        HPDF_Page_Rectangle(page, margin - 5.0f, margin - 5.0f,
-                            page_width - 2 * margin + 10.0f,
-                            page_height - 2 * margin + 10.0f);
-        HPDF_Page_Stroke(page);
+// Any input generate_files accepts, keeping the records that match filter.
+// Record files seek through their index; everything else is scanned.
+void streamInput(const string &filename, const RecordFilter &filter, const function<void(const Record &)> &visit, bool warn)
+{
+    if (isRecordFile(filename))
+    {
+        RecordFile file(filename);
+        Arena arena;
+        file.select(filter, arena, false, visit);
+        return;
     }
-
-    void loadImagesAndText()
+    if (!filter.empty())
     {
-        loadImage("left_image.jpeg", margin, HPDF_Page_GetHeight(page) - 110.0f);
-        loadImage("right_image.jpeg", HPDF_Page_GetWidth(page) - margin - 60.0f, HPDF_Page_GetHeight(page) - 110.0f);
-
-        const string centered_text = "Name_Head";
-        float page_width = HPDF_Page_GetWidth(page);
-        HPDF_Page_BeginText(page);
-        HPDF_Page_SetFontAndSize(page, font, 20.0f);
-        float text_width = HPDF_Page_TextWidth(page, centered_text.c_str());
-        float text_x_position = (page_width / 2) - (text_width / 2);
-        float text_y_position = HPDF_Page_GetHeight(page) - 70.0f;
-        HPDF_Page_MoveTextPos(page, text_x_position, text_y_position);
-        HPDF_Page_ShowText(page, centered_text.c_str());
-        HPDF_Page_EndText(page);
-
-        current_y_position -= 80.0f; // Space for images and title (adjust as needed)
+        streamInput(filename, RecordFilter(), [&](const Record &record)
+                    {
+            if (filter.matches(record))
+            {
+                visit(record);
+            } }, warn);
+        return;
     }
 
-    void loadImage(const string &filename, float x, float y)
+    if (filesystem::is_directory(filename))
     {
-        HPDF_Image img = HPDF_LoadJpegImageFromFile(pdf, filename.c_str());
-        if (img != nullptr)
-        {
-            HPDF_Page_DrawImage(page, img, x, y, 60.0f, 60.0f);
-        }
-        else
+        for (const auto &segment : WriteAheadLog::listSegments(filename))
         {
-            cerr << "Warning: Could not load image " << filename << endl;
+            streamNdjsonFile(segment.path, visit, warn);
         }
+        return;
     }
 
-    void drawPageNumber()
+    ifstream file(filename);
+    if (!file.is_open())
+    {
+        throw runtime_error("Could not open JSON file: " + filename);
+    }
+    file >> ws;
+    if (file.peek() != '[')
     {
-        HPDF_Page_BeginText(page);
-        HPDF_Page_SetFontAndSize(page, font, 12.0f);
-        stringstream page_num_str;
-        page_num_str << "Page " << page_number;
-        float page_width = HPDF_Page_GetWidth(page);
-        float text_width = HPDF_Page_TextWidth(page, page_num_str.str().c_str());
-        HPDF_Page_MoveTextPos(page, (page_width / 2) - (text_width / 2), margin - 20.0f);
-        HPDF_Page_ShowText(page, page_num_str.str().c_str());
-        HPDF_Page_EndText(page);
-        page_number++;
+        file.close();
+        streamNdjsonFile(filename, visit, warn);
+        return;
     }
 
-    float calculateTotalHeightForArray(const vector<string> &array_data)
+    // Each array element is converted as soon as it has been parsed, then
+    // dropped from the array, so the DOM never holds more than one entry
+    Arena arena;
+    json::parser_callback_t element_done = [&](int depth, json::parse_event_t event, json &parsed)
     {
-        float total_height = 0.0f;
-        for (const auto &item : array_data)
+        if (depth != 1 || (event != json::parse_event_t::object_end && event != json::parse_event_t::array_end &&
+                           event != json::parse_event_t::value))
         {
-            vector<string> row_data = {item}; // Treat each array element as a row
-            vector<vector<string>> wrapped_lines;
-            float cell_height = wrapTextInRow(row_data, wrapped_lines);
-            total_height += cell_height;
+            return true;
         }
-        return total_height;
+        Arena::Mark mark = arena.mark();
+        Record record;
+        Record::fromJson(parsed, arena, record); // Non-objects give an empty record
+        visit(record);
+        arena.rewind(mark);
+        return false;
+    };
+    try
+    {
+        json ignored = json::parse(file, element_done);
     }
-    void drawArrayRowWithBorder(const string &key, const vector<string> &array_data, float y_position, float total_cell_height)
+    catch (const json::exception &e)
     {
-        float x_position = margin;
-        const float light_pink[] = {1.0f, 0.8f, 0.8f}; // Light pink color
-
-        // Set background color for key column (light pink)
-        HPDF_Page_SetRGBFill(page, light_pink[0], light_pink[1], light_pink[2]);
-        HPDF_Page_Rectangle(page, x_position, y_position - total_cell_height, key_col_width, total_cell_height); // Key column background
-        HPDF_Page_Fill(page);
+        throw runtime_error("Could not parse JSON file " + filename + ": " + e.what());
+    }
+}
 
-        // Draw the border around the key column
-        HPDF_Page_SetLineWidth(page, 1.0f);
-        HPDF_Page_Rectangle(page, x_position, y_position - total_cell_height, key_col_width, total_cell_height); // Key column border
-        HPDF_Page_Stroke(page);
+// Latest receive time in the input (0 if no record has one)
+uint64_t latestReceived(const string &filename)
+{
+    if (isRecordFile(filename))
+    {
+        return RecordFile(filename).latestReceived();
+    }
+    uint64_t latest = 0;
+    streamInput(filename, RecordFilter(), [&](const Record &record)
+                { latest = max(latest, record.received_ns); }, false);
+    return latest;
+}
 
-        // Print the key (once)
-        HPDF_Page_BeginText(page);
-        HPDF_Page_SetFontAndSize(page, font, font_size);
-        HPDF_Page_MoveTextPos(page, x_position + cell_padding, y_position - cell_padding - line_height);
-        HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f); // Black color for text
-        HPDF_Page_ShowText(page, key.c_str());
-        HPDF_Page_EndText(page);
+// Writes the matching records of any input as a record file or as NDJSON
+uint64_t convertInput(const string &input, const RecordFilter &filter, const string &output, const string &format)
+{
+    uint64_t count = 0;
+    if (format == "records")
+    {
+        RecordFileWriter writer(output);
+        streamInput(input, filter, [&](const Record &record)
+                    { writer.append(record); }, true);
+        writer.finish();
+        return writer.recordCount();
+    }
 
-        // Move to the value column position
-        x_position += key_col_width;
+    ofstream out(output, ios::binary | ios::trunc);
+    if (!out.is_open())
+    {
+        throw runtime_error("Could not create file: " + output);
+    }
+    string line;
+    streamInput(input, filter, [&](const Record &record)
+                {
+        line.clear();
+        record.appendJson(line);
+        line += '\n';
+        out.write(line.data(), line.size());
+        count++; }, true);
+    out.close();
+    if (out.fail())
+    {
+        throw runtime_error("Failed to write file: " + output);
+    }
+    return count;
+}
 
-        // Draw the border around the value column
-        HPDF_Page_Rectangle(page, x_position, y_position - total_cell_height, value_col_width, total_cell_height); // Value column border
-        HPDF_Page_Stroke(page);
+bool parseCount(const char *text, size_t &value)
+{
+    char *end;
+    errno = 0;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-')
+    {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
 
-        // Draw the array values inside the value column (no background fill, just text and border)
-        float text_y_position = y_position - cell_padding - line_height;
-        for (const auto &array_item : array_data)
+// "90", "90s", "10m", "2h", "1d"
+bool parseDuration(const char *text, uint64_t &seconds)
+{
+    size_t value;
+    string number(text);
+    uint64_t unit = 1;
+    if (!number.empty() && !isdigit(static_cast<unsigned char>(number.back())))
+    {
+        switch (number.back())
         {
-            HPDF_Page_BeginText(page);
-            HPDF_Page_SetFontAndSize(page, font, font_size);
-            HPDF_Page_MoveTextPos(page, x_position + cell_padding, text_y_position);
-            HPDF_Page_ShowText(page, array_item.c_str());
-            HPDF_Page_EndText(page);
-
-            text_y_position -= line_height + cell_padding; // Move down for the next array item
+        case 's':
+            unit = 1;
+            break;
+        case 'm':
+            unit = 60;
+            break;
+        case 'h':
+            unit = 3600;
+            break;
+        case 'd':
+            unit = 86400;
+            break;
+        default:
+            return false;
         }
+        number.pop_back();
     }
-
-    void drawTableForEntry(const json &entry)
+    if (!parseCount(number.c_str(), value) || value > UINT64_MAX / 1000000000 / unit)
     {
-        const vector<string> keys = {"cmd_name", "data", "range", "status", "input_other", "output_other"};
+        return false;
+    }
+    seconds = value * unit;
+    return true;
+}
 
-        for (const auto &key : keys)
+int main(int argc, char *argv[])
+{
+    RenderOptions options;
+    bool stream = false;
+    string format = "pdf";
+    RecordFilter filter;
+    uint64_t last_seconds = 0;
+    vector<string> positional;
+    bool usage_error = false;
+    for (int i = 1; i < argc && !usage_error; ++i)
+    {
+        const string arg = argv[i];
+        size_t value;
+        if (arg == "--split")
         {
-            if (entry.contains(key))
-            {
-                vector<string> row_data;
-                row_data.push_back(key);
-
-                // Handle string values
-                if (entry[key].is_string())
-                {
-                    row_data.push_back(entry[key].get<string>());
-
-                    // Wrap text and calculate max cell height
-                    vector<vector<string>> wrapped_lines;
-                    float max_cell_height = wrapTextInRow(row_data, wrapped_lines);
-
-                    // Check if we need a new page due to height
-                    if (current_y_position - max_cell_height < margin)
-                    {
-                        addNewPage();
-                    }
-
-                    // Draw the row
-                    drawRow(row_data, wrapped_lines, current_y_position, max_cell_height);
-                    current_y_position -= max_cell_height; // Move down for the next row
-                }
-                // Handle array values - print key once, no individual borders for array items, but border for the whole block
-                else if (entry[key].is_array())
-                {
-                    vector<string> array_data;
-                    for (const auto &item : entry[key])
-                    {
-                        array_data.push_back(item.get<string>());
-                    }
-
-                    // Calculate total height for all array items
-                    float total_cell_height = calculateTotalHeightForArray(array_data);
-
-                    // If current page doesn't have enough space, add a new page
-                    if (current_y_position - total_cell_height < margin)
-                    {
-                        addNewPage();
-                    }
-
-                    // Draw the block with a border for the key and the array values
-                    drawArrayRowWithBorder(key, array_data, current_y_position, total_cell_height);
-
-                    // Move down after drawing
-                    current_y_position -= total_cell_height;
-                }
-            }
+            options.split = true;
+        }
+        else if (arg == "--stream")
+        {
+            stream = true;
+        }
+        else if (arg == "--jobs" && i + 1 < argc && parseCount(argv[i + 1], value))
+        {
+            options.jobs = value;
+            ++i;
         }
+        else if (arg == "--shard-pages" && i + 1 < argc && parseCount(argv[i + 1], value) && value <= 1000000)
+        {
+            options.shard_pages = static_cast<int>(value);
+            ++i;
+        }
+        else if (arg == "--last" && i + 1 < argc && parseDuration(argv[i + 1], last_seconds) && last_seconds > 0)
+        {
+            ++i;
+        }
+        else if (arg == "--status" && i + 1 < argc)
+        {
+            filter.statuses.push_back(argv[++i]);
+        }
+        else if (arg == "--cmd" && i + 1 < argc)
+        {
+            filter.cmd_names.push_back(argv[++i]);
+        }
+        else if (arg == "--summary" && i + 1 < argc && parse_summary_mode(argv[i + 1], options.summary))
+        {
+            ++i;
+        }
+        else if (arg == "--format" && i + 1 < argc &&
+                 (string(argv[i + 1]) == "pdf" || string(argv[i + 1]) == "records" || string(argv[i + 1]) == "ndjson"))
+        {
+            format = argv[++i];
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            usage_error = true;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
 
-        current_y_position -= 20.0f; // Space between tables
+    if (usage_error || positional.size() != 2)
+    {
+        cerr << "Usage: " << argv[0] << " [--jobs N] [--shard-pages N] [--split] [--stream] [--format pdf|records|ndjson]"
+             << " [--summary off|first|only] [--last DURATION] [--status S]... [--cmd NAME]..."
+             << " <input.json|input.ndjson|input.urf|wal-dir> <output|->" << endl;
+        return 1;
     }
 
-    string formatArray(const json &array)
+    const string json_filename = positional[0];
+    string output_filename = positional[1];
+    if (output_filename == "-" && format == "pdf")
     {
-        string combined;
-        for (const auto &item : array)
-        {
-            // Add each item followed by a newline character
-            combined += item.get<string>() + "\n \n";
-        }
-        return combined;
+        // Straight to standard output (a pipe, say); shards are temporary
+        // files named after the process
+        options.fd = STDOUT_FILENO;
+        output_filename = (filesystem::temp_directory_path() / ("report-" + to_string(getpid()) + ".pdf")).string();
     }
+    // Progress goes to stderr when stdout carries the report
+    ostream &status = options.fd == -1 ? cout : cerr;
 
-    float wrapTextInRow(const vector<string> &row, vector<vector<string>> &wrapped_lines)
+    try
     {
-        float max_cell_height = 0.0f;
-        for (size_t i = 0; i < row.size(); ++i)
+        if (last_seconds > 0)
         {
-            const string cell_content = row[i];
-            const float cell_width = (i == 0) ? key_col_width : value_col_width;
-
-            // Wrap the text considering newline characters
-            vector<string> wrapped = TextWrapper::wrapText(cell_content, font, font_size, cell_width - 2 * cell_padding, page); // Respect padding
-            wrapped_lines.push_back(wrapped);
-
-            float cell_height = (wrapped.size() * line_height) + 2 * cell_padding; // Text height + padding
-            if (cell_height > max_cell_height)
+            // Relative to the newest record, so old captures work too
+            uint64_t latest = latestReceived(json_filename);
+            if (latest == 0)
             {
-                max_cell_height = cell_height;
+                cerr << "Warning: no record in " << json_filename << " has a receive time" << endl;
             }
+            uint64_t window = last_seconds * 1000000000;
+            filter.received_from_ns = latest > window ? latest - window : 1;
         }
-        return max_cell_height;
-    }
 
-    void drawRow(const vector<string> &row, const vector<vector<string>> &wrapped_lines, float y_position, float max_cell_height)
-    {
-        float x_position = margin;
-        const float light_pink[] = {1.0f, 0.8f, 0.8f};
-        for (size_t i = 0; i < row.size(); ++i)
+        if (format != "pdf")
+        {
+            uint64_t count = convertInput(json_filename, filter, output_filename, format);
+            cout << "Wrote " << count << " record(s) to " << output_filename << "\n";
+            return 0;
+        }
+
+        vector<string> written;
+        if (stream)
+        {
+            // Read twice by streamReport; warn about skipped lines only once
+            bool first_pass = true;
+            written = streamReport([&](const function<void(const Record &)> &visit)
+                                   {
+                streamInput(json_filename, filter, visit, first_pass);
+                first_pass = false; }, output_filename, options);
+        }
+        else if (isRecordFile(json_filename))
+        {
+            // Strings stay in the mapping; only list item arrays are copied
+            RecordFile file(json_filename);
+            Arena arena;
+            vector<Record> records;
+            file.select(filter, arena, true, [&](const Record &record)
+                        { records.push_back(record); });
+            written = generateReport(records, output_filename, options);
+        }
+        else if (filter.empty())
+        {
+            json jsonData;
+            parseJsonFile(json_filename, jsonData);
+            written = generateReport(jsonData, output_filename, options);
+        }
+        else
         {
-            const auto &wrapped = wrapped_lines[i];
-            const float cell_width = (i == 0) ? key_col_width : value_col_width;
-            if (i == 0)
+            json jsonData;
+            parseJsonFile(json_filename, jsonData);
+            Arena arena;
+            StringInterner interner(1 << 16); // Kept records share repeated values
+            vector<Record> records;
+            for (const auto &entry : jsonData)
             {
-                HPDF_Page_SetRGBFill(page, light_pink[0], light_pink[1], light_pink[2]);
-                HPDF_Page_Rectangle(page, x_position, y_position - max_cell_height, cell_width, max_cell_height);
-                HPDF_Page_Fill(page); // Fill the rectangle with light pink
-            }
-            // Set fill color based on the status
-            HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f); // Reset to black for text
-            if (i == 3)
-            { // Assuming the status is in the fourth column (index 3)
-                if (row[i] == "pass" || row[i] == "Pass")
+                Arena::Mark mark = arena.mark();
+                Record record;
+                Record::fromJson(entry, arena, record, &interner);
+                if (filter.matches(record))
                 {
-                    HPDF_Page_SetRGBFill(page, 0.0f, 0.5f, 0.0f); // Green
+                    records.push_back(record);
                 }
-                else if (row[i] == "fail" || row[i] == "Fail")
+                else
                 {
-                    HPDF_Page_SetRGBFill(page, 0.5f, 0.0f, 0.0f); // Red
+                    arena.rewind(mark);
                 }
-                HPDF_Page_Rectangle(page, x_position, y_position - max_cell_height, cell_width, max_cell_height);
-                HPDF_Page_Fill(page);                         // Fill the cell with the color
-                HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f); // Reset to black for text
-            }
-
-            else
-            {
-                HPDF_Page_SetLineWidth(page, 1.0f);
-                HPDF_Page_Rectangle(page, x_position, y_position - max_cell_height, cell_width, max_cell_height);
-                HPDF_Page_Stroke(page);
             }
-
-            float text_y_position = y_position - cell_padding - line_height;
-
-            for (const auto &line : wrapped)
-            {
-                HPDF_Page_BeginText(page);
-                HPDF_Page_SetFontAndSize(page, font, font_size);
-                HPDF_Page_MoveTextPos(page, x_position + cell_padding, text_y_position);
-                HPDF_Page_ShowText(page, line.c_str());
-                HPDF_Page_EndText(page);
-                text_y_position -= line_height;
-            }
-
-            x_position += cell_width;
-            HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f);
+            written = generateReport(records, output_filename, options);
+        }
+        status << "PDF generated sucessfully\n";
+        if (options.split)
+        {
+            status << written.size() << " file(s): " << written.front() << " to " << written.back() << "\n";
         }
-    }
-};
-
-void parseJsonFile(const string &filename, json &jsonData)
-{
-    ifstream file(filename);
-    if (!file.is_open())
-    {
-        throw runtime_error("Could not open JSON file: " + filename);
-    }
-    file >> jsonData;
-}
-
-int main(int argc, char *argv[])
-{
-    if (argc != 3)
-    {
-        cerr << "Usage: " << argv[0] << " <input.json> <output.pdf>" << endl;
-        return 1;
-    }
-
-    const string json_filename = argv[1];
-    const string pdf_filename = argv[2];
-
-    try
-    {
-        json jsonData;
-        parseJsonFile(json_filename, jsonData);
-
-        PDFDocument pdfDocument(pdf_filename);
-        pdfDocument.generatePDF(jsonData);
-        cout << "PDF generated sucessfully\n";
     }
     catch (const runtime_error &e)
     {
@@ -439,4 +443,4 @@ int main(int argc, char *argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
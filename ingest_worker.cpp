@@ -0,0 +1,359 @@
+#include "ingest_worker.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using namespace std;
+namespace fs = std::filesystem;
+
+int open_udp_socket(uint16_t port, bool reuse_port)
+{
+    int sockfd;
+    struct sockaddr_in server_addr;
+
+    // Create UDP socket
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        cerr << "Failed to create socket.\n";
+        return -1;
+    }
+
+    if (reuse_port)
+    {
+        int one = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+        {
+            cerr << "Failed to set SO_REUSEPORT: " << strerror(errno) << endl;
+            close(sockfd);
+            return -1;
+        }
+    }
+
+    // Give the kernel room to absorb bursts while a batch is being processed
+    int rcvbuf = 4 * 1024 * 1024;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+    {
+        cerr << "Warning: failed to enlarge socket receive buffer.\n";
+    }
+
+    // Set up server address
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        cerr << "Bind failed: " << strerror(errno) << endl;
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+IngestWorker::IngestWorker(int id, uint16_t port, Logger &logger, const WorkerOptions &options)
+    : worker_id(id), port(port), sockfd(-1), log(logger.channel()), on_stored(options.on_stored), pool(options.max_datagram, options.pool_buffers),
+      ring(options.pool_buffers), receive_done(false), reassembler(options.reassembly), interner(options.interner),
+      scanner(options.scan), parser(options.interner), store(id, options.store),
+      replay_budget(options.store.spill_dir.empty() ? options.store.memory_limit / 2 : 0),
+      wal(options.wal, [this](const string &text)
+          { log.message(LogLevel::Error, worker_id, text); })
+{
+    // The ring holds at least as many slots as there are buffers, so a
+    // datagram that got a buffer always gets a slot
+}
+
+IngestWorker::~IngestWorker()
+{
+    if (receive_thread.joinable())
+    {
+        stop();
+    }
+    join();
+    if (sockfd != -1)
+    {
+        close(sockfd);
+    }
+}
+
+void IngestWorker::replay(const vector<string> &segment_paths)
+{
+    // Keep the newest segments that fit in the budget; a segment's file is
+    // a fair estimate of what its records take in the store
+    size_t first = segment_paths.size();
+    uintmax_t total = 0;
+    while (first > 0)
+    {
+        error_code ec;
+        const uintmax_t size = fs::file_size(segment_paths[first - 1], ec);
+        if (replay_budget > 0 && !ec && total + size > replay_budget)
+        {
+            break;
+        }
+        total += ec ? 0 : size;
+        first--;
+    }
+    stats.skipped_segments = first;
+
+    for (size_t i = first; i < segment_paths.size(); ++i)
+    {
+        const string &path = segment_paths[i];
+        WriteAheadLog::readSegment(path, [this](const char *line, size_t length)
+                                   {
+            Arena &arena = store.arena();
+            Record record;
+            if (!parser.parse(line, length, arena, record) &&
+                !Record::fromJson(json::parse(line, line + length, nullptr, false), arena, record, interner))
+            {
+                stats.torn_lines++;
+                return;
+            }
+            // Records the overload policy refuses are counted by the store
+            if (store.push_back(record))
+            {
+                stats.replayed++;
+            } }, stats.torn_lines);
+    }
+}
+
+bool IngestWorker::start(int cpu)
+{
+    if (!wal.open(worker_id))
+    {
+        return false;
+    }
+
+    sockfd = open_udp_socket(port, true);
+    if (sockfd == -1)
+    {
+        return false;
+    }
+
+    engine.reset(new ReceiveEngine(sockfd, pool, [this](char *buffer, size_t length, const sockaddr_in &sender, bool truncated, uint64_t received_ns)
+                                   { enqueueDatagram(buffer, length, sender, truncated, received_ns); }));
+    if (!engine->init())
+    {
+        return false;
+    }
+
+    parse_thread = std::thread([this]
+                               { runParseStage(); });
+    receive_thread = std::thread([this]
+                                 { engine->run(); });
+
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int err = pthread_setaffinity_np(receive_thread.native_handle(), sizeof(cpus), &cpus);
+        if (err != 0)
+        {
+            cerr << "Warning: failed to pin worker " << worker_id << " to CPU " << cpu << ": " << strerror(err) << endl;
+        }
+    }
+
+    return true;
+}
+
+void IngestWorker::stop()
+{
+    if (engine)
+    {
+        engine->stop();
+    }
+}
+
+void IngestWorker::join()
+{
+    if (receive_thread.joinable())
+    {
+        receive_thread.join();
+    }
+
+    // Nothing more will be enqueued; the parse stage exits once the ring is empty
+    receive_done.store(true);
+    doorbell.wake();
+    if (parse_thread.joinable())
+    {
+        parse_thread.join();
+    }
+}
+
+// Receive stage: hand the buffer on and move on, never wait for the parse stage
+void IngestWorker::enqueueDatagram(char *buffer, size_t length, const sockaddr_in &sender, bool truncated, uint64_t received_ns)
+{
+    stats.received.fetch_add(1, memory_order_relaxed);
+    stats.bytes.fetch_add(length, memory_order_relaxed);
+
+    DatagramSlice *slice = ring.claim(); // Never full, see the constructor
+    slice->buffer = buffer;
+    slice->length = static_cast<uint32_t>(length);
+    slice->truncated = truncated;
+    slice->sender = sender;
+    slice->received_ns = received_ns;
+    ring.publish();
+    doorbell.ring();
+}
+
+// Datagrams between time checks while the ring stays busy
+static const size_t HOUSEKEEPING_SLICES = 256;
+
+void IngestWorker::runParseStage()
+{
+    while (true)
+    {
+        DatagramSlice *slice;
+        size_t processed = 0;
+        while ((slice = ring.front()) != nullptr)
+        {
+            // A parse stage that never catches up still commits on time and
+            // expires stale fragments
+            if (++processed % HOUSEKEEPING_SLICES == 0)
+            {
+                wal.tick();
+                reassembler.expire();
+            }
+            processSlice(*slice);
+            // The slot goes back first: once the buffer is free the receive
+            // stage may fill it and claim a slot for it right away
+            char *buffer = slice->buffer;
+            ring.pop();
+            pool.release(buffer);
+        }
+
+        if (receive_done.load())
+        {
+            if (ring.empty())
+            {
+                // Shutdown only has to make the tail durable
+                wal.close();
+                return;
+            }
+            continue;
+        }
+
+        // Wake up at least once per sync interval so a quiet socket still
+        // gets its last records committed and stale fragments expire
+        doorbell.wait([this]
+                      { return !ring.empty() || receive_done.load(); },
+                      wal.syncIntervalMs());
+        wal.tick();
+        reassembler.expire();
+    }
+}
+
+void IngestWorker::processSlice(const DatagramSlice &slice)
+{
+    if (slice.truncated)
+    {
+        stats.truncated.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    FragmentHeader header;
+    if (!FragmentHeader::parse(slice.buffer, slice.length, header))
+    {
+        processMessage(slice.buffer, slice.length, slice);
+        return;
+    }
+
+    if (reassembler.add(slice.sender, header, slice.buffer + FragmentHeader::SIZE, slice.length - FragmentHeader::SIZE,
+                        reassembled))
+    {
+        // Stamped with the fragment that completed the message
+        processMessage(reassembled.data(), reassembled.size(), slice);
+    }
+}
+
+// A message may carry several records; each one is parsed where it lies
+void IngestWorker::processMessage(const char *data, size_t length, const DatagramSlice &origin)
+{
+    record_slices.clear();
+    if (!Envelope::split(data, length, record_slices))
+    {
+        stats.envelope_errors.fetch_add(1, memory_order_relaxed);
+    }
+    if (record_slices.size() > 1)
+    {
+        stats.batched.fetch_add(record_slices.size(), memory_order_relaxed);
+    }
+    for (const auto &slice : record_slices)
+    {
+        parseRecord(slice.data(), slice.size(), origin);
+    }
+}
+
+// Counted and logged; nothing is thrown, so a flood of garbage costs about
+// as much as the pre-check that turns it away
+void IngestWorker::reject(RejectReason reason)
+{
+    stats.parse_errors.fetch_add(1, memory_order_relaxed);
+    stats.rejected[static_cast<size_t>(reason)].fetch_add(1, memory_order_relaxed);
+    log.parseError(worker_id, reject_reason_text(reason));
+}
+
+void IngestWorker::parseRecord(const char *data, size_t length, const DatagramSlice &origin)
+{
+    RejectReason reason = scanner.scan(data, length);
+    if (reason != RejectReason::None)
+    {
+        reject(reason);
+        return;
+    }
+
+    // Fast path: schema-specific parser straight into the store's arena
+    Arena &arena = store.arena();
+    Record record;
+    if (!parser.parse(data, length, arena, record))
+    {
+        // Generic path for unknown members, other value types and syntax errors
+        // the pre-check does not look for
+        stats.generic_parses.fetch_add(1, memory_order_relaxed);
+        json parsed = json::parse(data, data + length, nullptr, false);
+        if (parsed.is_discarded())
+        {
+            reject(RejectReason::Malformed);
+            return;
+        }
+        if (!Record::fromJson(parsed, arena, record, interner))
+        {
+            reject(RejectReason::NotObject);
+            return;
+        }
+    }
+
+    // Whatever the sender claimed, the receive metadata is ours
+    record.received_ns = origin.received_ns;
+    record.sender_ip = origin.sender.sin_addr.s_addr;
+    record.sender_port = ntohs(origin.sender.sin_port);
+
+    // Logged first: a record the store refuses has its text released, and the
+    // WAL keeps every record anyway. The refusal is counted by the store.
+    wal.append(record);
+    if (!store.push_back(record))
+    {
+        return;
+    }
+    stats.stored.fetch_add(1, memory_order_relaxed);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now); // The kernel stamps arrivals on this clock
+    uint64_t now_ns = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+    stats.ingest_latency.record(now_ns > origin.received_ns ? now_ns - origin.received_ns : 0);
+    if (on_stored)
+    {
+        on_stored(worker_id, record);
+    }
+
+    log.record(worker_id, record);
+}
@@ -0,0 +1,171 @@
+#ifndef INGEST_WORKER_H
+#define INGEST_WORKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include "buffer_pool.h"
+#include "envelope.h"
+#include "latency_histogram.h"
+#include "logger.h"
+#include "reassembler.h"
+#include "receive_engine.h"
+#include "record.h"
+#include "record_scanner.h"
+#include "record_store.h"
+#include "string_interner.h"
+#include "ring_buffer.h"
+#include "write_ahead_log.h"
+
+// Opens a non-blocking UDP socket bound to port. With reuse_port set, several
+// sockets can bind the same port and the kernel spreads datagrams across them.
+// Returns -1 on failure.
+int open_udp_socket(uint16_t port, bool reuse_port);
+
+struct WorkerOptions
+{
+    size_t max_datagram = 65536; // Receive buffer size; larger datagrams are truncated and dropped
+    size_t pool_buffers = 1024;  // Datagrams that can be in flight between the stages
+    ReassemblyOptions reassembly;
+    WalOptions wal;
+    StoreOptions store;
+    ScanLimits scan; // Records failing the pre-check are rejected before parsing
+    StringInterner *interner = nullptr; // Shared by the workers for repeated values; null copies them all
+    // Called on the parse thread after each record is stored (benchmarks)
+    std::function<void(int worker, const Record &record)> on_stored;
+};
+
+// Raw datagram as handed from the receive stage to the parse stage. The
+// buffer belongs to the worker's pool; the parse stage returns it.
+struct DatagramSlice
+{
+    char *buffer;
+    uint32_t length;
+    bool truncated;
+    sockaddr_in sender;
+    uint64_t received_ns; // Kernel receive timestamp
+};
+
+struct WorkerCounters
+{
+    std::atomic<uint64_t> received{0};  // Datagrams taken off the socket
+    std::atomic<uint64_t> bytes{0};     // Their payload bytes
+    std::atomic<uint64_t> truncated{0}; // Larger than max_datagram; dropped
+    std::atomic<uint64_t> batched{0};         // Records that shared a datagram with others
+    std::atomic<uint64_t> envelope_errors{0}; // Malformed framed envelopes
+    std::atomic<uint64_t> parse_errors{0};    // Records rejected, whatever the reason
+    std::atomic<uint64_t> rejected[REJECT_REASONS]{}; // The same by reason
+    std::atomic<uint64_t> generic_parses{0}; // Fell back to nlohmann::json
+    std::atomic<uint64_t> stored{0};
+    SharedLatencyHistogram ingest_latency; // Kernel receive to stored, nanoseconds
+    uint64_t replayed = 0;   // Records recovered from the WAL at startup
+    uint64_t torn_lines = 0; // Incomplete or unparsable WAL lines skipped during replay
+    uint64_t skipped_segments = 0; // Older WAL segments left out of replay to stay within the store budget
+};
+
+// One ingestion shard: owns its SO_REUSEPORT socket and a two-stage pipeline.
+// The receive thread (pinned to a core) receives straight into pooled buffers
+// and passes them through an SPSC ring; the parse thread reassembles
+// fragmented messages, splits batched envelopes in place, pre-checks each
+// record (see record_scanner.h) and rejects bad ones by reason, parses the rest
+// into a typed Record whose strings live in the store chunk it goes to
+// (repeated values in the interner shared by all shards instead), stamps it
+// with the datagram's receive time and sender, appends it to the shard's
+// local store and its write-ahead log, and recycles the buffer.
+// When every buffer is in flight the newest datagrams are dropped (and
+// counted), so the socket is always drained. The store keeps to its memory
+// limit by spilling or dropping records (see record_store.h); the WAL keeps
+// them all.
+// The store can be snapshotted while the worker runs, so reports never have
+// to stop ingestion.
+class IngestWorker
+{
+public:
+    // Logs through a channel of its own on logger
+    IngestWorker(int id, uint16_t port, Logger &logger, const WorkerOptions &options);
+    ~IngestWorker();
+
+    IngestWorker(const IngestWorker &) = delete;
+    IngestWorker &operator=(const IngestWorker &) = delete;
+
+    // Loads records from existing WAL segments into the store. Call before start().
+    // With a memory limit and no spill directory only the newest segments
+    // whose files fit in half the limit are loaded, so history never crowds
+    // out live records; the rest stay on disk until retention removes them.
+    void replay(const std::vector<std::string> &segment_paths);
+
+    // Opens the socket and the WAL and starts both stages; the receive thread
+    // is pinned to cpu if cpu >= 0.
+    bool start(int cpu);
+    void stop();
+
+    // Joins the receive thread, lets the parse stage drain the ring and
+    // commit the WAL tail, joins it
+    void join();
+
+    int id() const { return worker_id; }
+    const WorkerCounters &counters() const { return stats; }
+
+    // Datagrams dropped because the parse stage still held every buffer
+    uint64_t backlogDrops() const { return engine ? engine->poolDrops() : 0; }
+
+    // Datagrams the kernel dropped because the socket's queue was full
+    uint64_t kernelDrops() const { return engine ? engine->kernelDrops() : 0; }
+
+    // Datagrams waiting for the parse stage
+    size_t queueDepth() const { return ring.size(); }
+
+    // Only safe to read after join()
+    const ReassemblyCounters &reassemblyCounters() const { return reassembler.counters(); }
+
+    // Consistent prefix of the stored records; safe at any time. Must not
+    // outlive the worker.
+    RecordStore::Snapshot snapshot() const { return store.snapshot(); }
+
+    // Memory held, spills and overload drops of the store; readable at any time
+    const StoreCounters &storeCounters() const { return store.counters(); }
+
+    // Failed WAL commits and records the WAL had no room for; readable at any time
+    const WalCounters &walCounters() const { return wal.counters(); }
+
+private:
+    int worker_id;
+    uint16_t port;
+    int sockfd;
+    LogChannel &log; // Parse thread only
+    std::function<void(int, const Record &)> on_stored;
+
+    BufferPool pool; // Declared before the engine, which returns buffers on destruction
+    std::unique_ptr<ReceiveEngine> engine;
+    std::thread receive_thread;
+    std::thread parse_thread;
+
+    SpscRing<DatagramSlice> ring;
+    Doorbell doorbell;
+    std::atomic<bool> receive_done;
+
+    WorkerCounters stats;
+    Reassembler reassembler;
+    std::string reassembled;
+    std::vector<std::string_view> record_slices;
+    StringInterner *interner;
+    RecordScanner scanner;
+    RecordParser parser;
+    RecordStore store;
+    size_t replay_budget; // Bytes of WAL segments replay may load; 0 is unlimited
+    WriteAheadLog wal;
+
+    void enqueueDatagram(char *buffer, size_t length, const sockaddr_in &sender, bool truncated, uint64_t received_ns);
+    void runParseStage();
+    void processSlice(const DatagramSlice &slice);
+    void processMessage(const char *data, size_t length, const DatagramSlice &origin);
+    void parseRecord(const char *data, size_t length, const DatagramSlice &origin);
+    void reject(RejectReason reason);
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond durations: each power of two is split
+// into 16 buckets, so any recorded value is known to within about 6% with a
+// fixed 8 KB of counters and O(1) recording. Not thread-safe; give each
+// thread its own and merge() them.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value)
+    {
+        counts[index(value)]++;
+        total++;
+        if (value > largest)
+        {
+            largest = value;
+        }
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        if (other.largest > largest)
+        {
+            largest = other.largest;
+        }
+    }
+
+    // Removes an earlier copy of this histogram, leaving what was recorded
+    // since; max() stays the maximum of all time
+    void subtract(const LatencyHistogram &earlier)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            counts[i] -= earlier.counts[i];
+        }
+        total -= earlier.total;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return largest; }
+
+    // Upper edge of the bucket holding quantile q (0..1); 0 when empty
+    uint64_t percentile(double q) const
+    {
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total));
+        if (rank >= total)
+        {
+            rank = total - 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += counts[i];
+            if (seen > rank)
+            {
+                uint64_t edge = upperEdge(i);
+                return edge < largest ? edge : largest;
+            }
+        }
+        return largest;
+    }
+
+private:
+    friend class SharedLatencyHistogram;
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t largest = 0;
+
+    static size_t index(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return static_cast<size_t>(value);
+        }
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return static_cast<size_t>(shift + 1) * SUB_BUCKETS + static_cast<size_t>((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperEdge(size_t i)
+    {
+        if (i < SUB_BUCKETS)
+        {
+            return i;
+        }
+        int shift = static_cast<int>(i / SUB_BUCKETS) - 1;
+        uint64_t lower = (SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+// The same histogram for one writer thread and any number of readers. The
+// writer updates its counters with plain atomic stores (no read-modify-write),
+// so recording costs about as much as in LatencyHistogram; a reader's
+// snapshot may miss records made while it was being taken.
+class SharedLatencyHistogram
+{
+public:
+    // Writer only
+    void record(uint64_t value)
+    {
+        std::atomic<uint64_t> &bucket = counts[LatencyHistogram::index(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (value > largest.load(std::memory_order_relaxed))
+        {
+            largest.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram snapshot() const
+    {
+        LatencyHistogram copy;
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i)
+        {
+            copy.counts[i] = counts[i].load(std::memory_order_relaxed);
+            copy.total += copy.counts[i];
+        }
+        copy.largest = largest.load(std::memory_order_relaxed);
+        return copy;
+    }
+
+private:
+    std::atomic<uint64_t> counts[LatencyHistogram::BUCKETS] = {};
+    std::atomic<uint64_t> largest{0};
+};
+
+#endif
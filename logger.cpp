@@ -0,0 +1,322 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+
+using namespace std;
+
+static uint64_t now_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Whole string or nothing more to do: a closed stream just loses the batch
+static void write_all(int fd, const string &text)
+{
+    size_t written = 0;
+    while (written < text.size())
+    {
+        ssize_t n = write(fd, text.data() + written, text.size() - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+static const char *const LEVEL_NAMES[] = {"debug", "info", "warn", "error", "off"};
+
+bool parse_log_level(const string &name, LogLevel &level)
+{
+    for (size_t i = 0; i < sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]); ++i)
+    {
+        if (name == LEVEL_NAMES[i])
+        {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+RateLimiter::RateLimiter(double rate)
+    : rate(rate), tokens(max(rate, 1.0)), last_ns(0), suppressed(0)
+{
+}
+
+bool RateLimiter::allow(uint64_t now)
+{
+    if (rate <= 0)
+    {
+        return true;
+    }
+    if (last_ns != 0 && now > last_ns)
+    {
+        tokens = min(max(rate, 1.0), tokens + static_cast<double>(now - last_ns) * rate / 1e9);
+    }
+    last_ns = max(last_ns, now);
+    if (tokens >= 1.0)
+    {
+        tokens -= 1.0;
+        return true;
+    }
+    suppressed++;
+    return false;
+}
+
+uint64_t RateLimiter::takeSuppressed()
+{
+    uint64_t n = suppressed;
+    suppressed = 0;
+    return n;
+}
+
+LogChannel::LogChannel(Logger &logger, const LogOptions &options)
+    : logger(logger), ring(options.buffer_lines), record_limit(options.records_per_s),
+      error_limit(options.errors_per_s), record_sample(options.record_sample), sample_count(0), dropped_lines(0),
+      suppressed_lines(0)
+{
+}
+
+bool LogChannel::enabled(LogLevel level) const
+{
+    return logger.enabled(level);
+}
+
+void LogChannel::record(int worker, const Record &record)
+{
+    if (record_sample == 0 || !enabled(LogLevel::Info))
+    {
+        return;
+    }
+    uint64_t time = record.received_ns != 0 ? record.received_ns : now_ns();
+    if (++sample_count < record_sample || !record_limit.allow(time))
+    {
+        suppressed_lines.store(suppressed_lines.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return;
+    }
+    sample_count = 0;
+
+    LogEntry entry;
+    entry.level = LogLevel::Info;
+    entry.worker = worker;
+    entry.time_ns = time;
+    entry.text = "Received data: ";
+    record.appendJson(entry.text);
+    entry.suppressed = record_limit.takeSuppressed();
+    push(move(entry));
+}
+
+void LogChannel::parseError(int worker, const char *message)
+{
+    if (!enabled(LogLevel::Warn))
+    {
+        return;
+    }
+    uint64_t time = now_ns();
+    if (!error_limit.allow(time))
+    {
+        suppressed_lines.store(suppressed_lines.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return;
+    }
+
+    LogEntry entry;
+    entry.level = LogLevel::Warn;
+    entry.worker = worker;
+    entry.time_ns = time;
+    entry.text = string("Error parsing JSON: ") + message;
+    entry.suppressed = error_limit.takeSuppressed();
+    push(move(entry));
+}
+
+void LogChannel::message(LogLevel level, int worker, string text)
+{
+    if (!enabled(level))
+    {
+        return;
+    }
+    LogEntry entry;
+    entry.level = level;
+    entry.worker = worker;
+    entry.time_ns = now_ns();
+    entry.text = move(text);
+    push(move(entry));
+}
+
+void LogChannel::push(LogEntry &&entry)
+{
+    if (!ring.tryPush(move(entry)))
+    {
+        dropped_lines.store(dropped_lines.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return;
+    }
+    logger.doorbell.ring();
+}
+
+Logger::Logger(const LogOptions &options)
+    : options(options), shared(1024), shared_dropped(0), stopping(false)
+{
+}
+
+Logger::~Logger()
+{
+    stop();
+}
+
+LogChannel &Logger::channel()
+{
+    lock_guard<mutex> lock(channels_mutex);
+    channels.emplace_back(new LogChannel(*this, options));
+    return *channels.back();
+}
+
+void Logger::log(LogLevel level, string text)
+{
+    if (!enabled(level))
+    {
+        return;
+    }
+    LogEntry entry;
+    entry.level = level;
+    entry.time_ns = now_ns();
+    entry.text = move(text);
+    if (!shared.tryPush(move(entry)))
+    {
+        shared_dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    doorbell.ring();
+}
+
+void Logger::start()
+{
+    thread = std::thread([this]
+                         { run(); });
+}
+
+void Logger::stop()
+{
+    if (thread.joinable())
+    {
+        stopping.store(true);
+        doorbell.wake();
+        thread.join();
+    }
+}
+
+uint64_t Logger::dropped() const
+{
+    uint64_t total = shared_dropped.load(memory_order_relaxed);
+    lock_guard<mutex> lock(channels_mutex);
+    for (const auto &channel : channels)
+    {
+        total += channel->dropped_lines.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Logger::suppressed() const
+{
+    uint64_t total = 0;
+    lock_guard<mutex> lock(channels_mutex);
+    for (const auto &channel : channels)
+    {
+        total += channel->suppressed_lines.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+void Logger::run()
+{
+    vector<LogChannel *> active;
+    while (true)
+    {
+        // Checked before draining, so every line queued before stop() is written
+        bool last = stopping.load();
+        {
+            lock_guard<mutex> lock(channels_mutex);
+            if (active.size() != channels.size())
+            {
+                active.clear();
+                for (const auto &channel : channels)
+                {
+                    active.push_back(channel.get());
+                }
+            }
+        }
+
+        if (drain(active))
+        {
+            continue;
+        }
+        if (last)
+        {
+            return;
+        }
+        doorbell.wait([&]
+                      { return stopping.load() || !shared.empty() ||
+                               any_of(active.begin(), active.end(), [](LogChannel *c)
+                                      { return !c->ring.empty(); }); });
+    }
+}
+
+// Formats one batch (at most a ring's worth per channel, so output keeps
+// flowing under load) and writes it. Returns false if there was nothing.
+bool Logger::drain(vector<LogChannel *> &active)
+{
+    string out;
+    string err;
+    for (LogChannel *channel : active)
+    {
+        size_t budget = channel->ring.capacity();
+        LogEntry *entry;
+        while (budget-- > 0 && (entry = channel->ring.front()) != nullptr)
+        {
+            format(*entry, entry->level >= LogLevel::Warn ? err : out);
+            channel->ring.pop();
+        }
+    }
+    LogEntry entry;
+    for (size_t budget = 1024; budget > 0 && shared.tryPop(entry); --budget)
+    {
+        format(entry, entry.level >= LogLevel::Warn ? err : out);
+    }
+
+    write_all(STDOUT_FILENO, out);
+    write_all(STDERR_FILENO, err);
+    return !out.empty() || !err.empty();
+}
+
+// "2024-05-01T12:00:00.123456Z info [worker 0] text"
+void Logger::format(const LogEntry &entry, string &out) const
+{
+    char prefix[96];
+    time_t seconds = static_cast<time_t>(entry.time_ns / 1000000000);
+    tm utc;
+    gmtime_r(&seconds, &utc);
+    size_t n = strftime(prefix, sizeof(prefix), "%Y-%m-%dT%H:%M:%S", &utc);
+    n += snprintf(prefix + n, sizeof(prefix) - n, ".%06uZ %s ",
+                  static_cast<unsigned>(entry.time_ns % 1000000000 / 1000), LEVEL_NAMES[static_cast<int>(entry.level)]);
+    if (entry.worker >= 0)
+    {
+        n += snprintf(prefix + n, sizeof(prefix) - n, "[worker %d] ", entry.worker);
+    }
+
+    if (entry.suppressed > 0)
+    {
+        out.append(prefix, n);
+        out += "(" + to_string(entry.suppressed) + " similar line(s) suppressed)\n";
+    }
+    out.append(prefix, n);
+    out += entry.text;
+    out += '\n';
+}
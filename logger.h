@@ -0,0 +1,152 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "record.h"
+#include "ring_buffer.h"
+
+enum class LogLevel : uint8_t
+{
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Off
+};
+
+// "debug", "info", "warn", "error" or "off"
+bool parse_log_level(const std::string &name, LogLevel &level);
+
+struct LogOptions
+{
+    LogLevel level = LogLevel::Info;
+    size_t buffer_lines = 4096; // Per channel; lines that do not fit are dropped
+    uint32_t record_sample = 1; // Log one received record in this many; 0 logs none
+    double records_per_s = 100; // Record lines per channel and second; 0 is unlimited
+    double errors_per_s = 10;   // Parse error lines per channel and second; 0 is unlimited
+};
+
+// One line on its way to the writer. The text is complete when queued (a
+// record's JSON included), so nothing it refers to has to outlive the line;
+// the writer only adds the prefix.
+struct LogEntry
+{
+    LogLevel level = LogLevel::Info;
+    int worker = -1;          // Shown as "[worker N]" when >= 0
+    uint64_t time_ns = 0;     // Since the epoch
+    std::string text;
+    uint64_t suppressed = 0;  // Similar lines the rate limit dropped before this one
+};
+
+// Token bucket: rate lines per second, bursts of up to one second's worth.
+// Single thread.
+class RateLimiter
+{
+public:
+    explicit RateLimiter(double rate);
+
+    // Returns false (and counts the line as suppressed) when over the rate
+    bool allow(uint64_t now_ns);
+
+    // Lines suppressed since the last call
+    uint64_t takeSuppressed();
+
+private:
+    double rate;
+    double tokens;
+    uint64_t last_ns;
+    uint64_t suppressed;
+};
+
+class Logger;
+
+// A producer's private path to the writer: an SPSC ring plus the producer's
+// own rate limits, so logging never takes a lock, never makes a syscall
+// unless the writer sleeps, and never waits. One thread only.
+class LogChannel
+{
+public:
+    bool enabled(LogLevel level) const;
+
+    // "Received data: <record>" at info level, sampled and rate limited. The
+    // record is formatted here, only once it is certain to be logged.
+    void record(int worker, const Record &record);
+
+    // Parse error at warning level, rate limited
+    void parseError(int worker, const char *message);
+
+    // Any other line; not rate limited
+    void message(LogLevel level, int worker, std::string text);
+
+private:
+    friend class Logger;
+
+    LogChannel(Logger &logger, const LogOptions &options);
+
+    Logger &logger;
+    SpscRing<LogEntry> ring;
+    RateLimiter record_limit;
+    RateLimiter error_limit;
+    uint32_t record_sample;
+    uint32_t sample_count;
+    std::atomic<uint64_t> dropped_lines;    // Buffer full; written by the producer only
+    std::atomic<uint64_t> suppressed_lines; // Sampled out or over the rate; likewise
+
+    void push(LogEntry &&entry);
+};
+
+// Asynchronous logger. Producers hand lines to a background writer, which
+// formats them and writes each batch to stdout (debug, info) and stderr
+// (warnings, errors) with one write per stream, so a slow terminal or pipe
+// only ever costs dropped lines, never a stalled producer.
+class Logger
+{
+public:
+    explicit Logger(const LogOptions &options);
+    ~Logger();
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    // New channel for one producing thread; lives as long as the logger.
+    // Thread-safe.
+    LogChannel &channel();
+
+    // From any thread, through a shared queue; for occasional lines
+    void log(LogLevel level, std::string text);
+
+    bool enabled(LogLevel level) const { return level >= options.level && level != LogLevel::Off; }
+
+    void start();
+
+    // Writes out whatever is still queued, then joins the writer
+    void stop();
+
+    // Lines lost to full buffers, and lines held back by sampling or rate limits
+    uint64_t dropped() const;
+    uint64_t suppressed() const;
+
+private:
+    friend class LogChannel;
+
+    LogOptions options;
+    mutable std::mutex channels_mutex; // Guards adding to channels
+    std::vector<std::unique_ptr<LogChannel>> channels;
+    MpscRing<LogEntry> shared;
+    std::atomic<uint64_t> shared_dropped;
+    Doorbell doorbell;
+    std::thread thread;
+    std::atomic<bool> stopping;
+
+    void run();
+    bool drain(std::vector<LogChannel *> &active);
+    void format(const LogEntry &entry, std::string &out) const;
+};
+
+#endif
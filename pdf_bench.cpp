@@ -0,0 +1,182 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "pdf_document.h"
+
+using json = nlohmann::ordered_json;
+using namespace std;
+
+// Synthetic records shaped like the ones client.py sends, with varying
+// lengths so that wrapping and page breaks get exercised
+static void makeRecords(size_t count, Arena &arena, vector<Record> &records)
+{
+    static const char *const WORDS[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+                                        "india", "juliett", "kilo", "lima", "mike", "november", "oscar", "papa"};
+    mt19937 random(42);
+    uniform_int_distribution<int> word(0, 15);
+    uniform_int_distribution<int> data_words(4, 60);
+    uniform_int_distribution<int> items(0, 4);
+
+    records.assign(count, Record());
+    for (size_t i = 0; i < count; ++i)
+    {
+        string data;
+        for (int w = data_words(random); w > 0; --w)
+        {
+            data += WORDS[word(random)];
+            data += ' ';
+        }
+        nlohmann::json entry = {{"cmd_name", "Command " + to_string(i)},
+                                {"data", data},
+                                {"range", "0-" + to_string(i % 1000)},
+                                {"status", i % 7 == 0 ? "FAIL" : "OK"}};
+        for (const char *list : {"input_other", "output_other"})
+        {
+            nlohmann::json values = nlohmann::json::array();
+            for (int n = items(random); n > 0; --n)
+            {
+                values.push_back(string(WORDS[word(random)]) + " " + to_string(n));
+            }
+            entry[list] = values;
+        }
+        Record::fromJson(entry, arena, records[i]);
+    }
+}
+
+static double millisecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Command line: ./pdf_bench [--sizes 1000,100000,1000000] [--jobs N] [--shard-pages N] [--output FILE]
+// Times layout on its own, then the whole report (layout, render, merge) as
+// generate_files produces it; render_ms is the difference. summary_ms is the
+// summary section's scan (columns and counts) on its own.
+int main(int argc, char *argv[])
+{
+    vector<size_t> sizes = {1000, 100000, 1000000};
+    RenderOptions options;
+    string output;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            cerr << "Missing value for " << arg << endl;
+            return -1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--sizes")
+        {
+            sizes.clear();
+            for (const char *p = value; *p;)
+            {
+                char *end;
+                size_t count = strtoull(p, &end, 10);
+                if (end == p || count == 0)
+                {
+                    cerr << "Invalid sizes " << value << endl;
+                    return -1;
+                }
+                sizes.push_back(count);
+                p = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (arg == "--jobs")
+        {
+            options.jobs = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--shard-pages")
+        {
+            options.shard_pages = atoi(value);
+        }
+        else if (arg == "--output")
+        {
+            output = value;
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--sizes N,N,...] [--jobs N] [--shard-pages N] [--output FILE]" << endl;
+            return -1;
+        }
+    }
+    if (sizes.empty() || options.shard_pages < 0)
+    {
+        cerr << "Invalid options.\n";
+        return -1;
+    }
+
+    const size_t jobs = options.jobs > 0 ? options.jobs : max<long>(1, sysconf(_SC_NPROCESSORS_ONLN));
+    const string report_path = "/tmp/pdf-bench-" + to_string(getpid()) + ".pdf";
+
+    json report;
+    report["benchmark"] = "pdf_report";
+    report["config"] = {{"jobs", jobs}, {"shard_pages", options.shard_pages}};
+    json &results = report["results"];
+    results = json::array();
+    for (size_t count : sizes)
+    {
+        Arena arena;
+        vector<Record> records;
+        makeRecords(count, arena, records);
+
+        try
+        {
+            ReportPlan plan;
+            PDFDocument planner(report_path);
+            auto start = chrono::steady_clock::now();
+            planner.layout(records, plan, jobs);
+            double layout_ms = millisecondsSince(start);
+
+            start = chrono::steady_clock::now();
+            RecordColumns columns;
+            for (const auto &record : records)
+            {
+                columns.push_back(record);
+            }
+            ReportSummary summary = summarize(columns);
+            double summary_ms = millisecondsSince(start);
+
+            start = chrono::steady_clock::now();
+            generateReport(records, report_path, options);
+            double report_ms = millisecondsSince(start);
+
+            results.push_back({{"entries", count},
+                               {"pages", plan.total_pages},
+                               {"layout_ms", layout_ms},
+                               {"render_ms", max(0.0, report_ms - layout_ms)},
+                               {"summary_ms", summary_ms},
+                               {"report_ms", report_ms},
+                               {"entries_per_s", count / (report_ms / 1e3)}});
+        }
+        catch (const runtime_error &e)
+        {
+            cerr << "Failed to generate report for " << count << " entries: " << e.what() << endl;
+            remove(report_path.c_str());
+            return -1;
+        }
+        remove(report_path.c_str());
+    }
+
+    if (output.empty())
+    {
+        cout << report.dump(2) << endl;
+    }
+    else
+    {
+        ofstream file(output);
+        file << report.dump(2) << endl;
+        if (!file)
+        {
+            cerr << "Failed to write " << output << endl;
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,1213 @@
+#include "pdf_document.h"
+
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <map>
+#include <unordered_map>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <ctime>
+#include <cerrno>
+#include <unistd.h>
+#include "pdf_merge.h"
+#include "string_interner.h"
+
+using json = nlohmann::json;
+using namespace std;
+
+// Wraps cell text into lines that fit a column. Widths come from a table of
+// the font's glyph advances, summed as integers while a line grows, so nothing
+// is measured twice; overlong words are split at binary-searched points. The
+// breaks are the same ones the original measure-the-whole-line loop produced,
+// including its quirks (a word that spills over always starts a fresh line of
+// its own, and pieces of long words are at most cell_width / 5 characters).
+class TextWrapper
+{
+public:
+    TextWrapper(HPDF_Font font, float font_size)
+        : font_size(font_size)
+    {
+        // The advances HPDF_Page_TextWidth sums, one byte at a time
+        for (int c = 0; c < 256; ++c)
+        {
+            HPDF_BYTE byte = static_cast<HPDF_BYTE>(c);
+            advances[c] = HPDF_Font_TextWidth(font, &byte, 1).width;
+        }
+    }
+
+    // A copy starts with the same cache; it does not share it
+    TextWrapper(const TextWrapper &other)
+        : font_size(other.font_size)
+    {
+        copy(begin(other.advances), end(other.advances), advances);
+        for (const auto &[width, cache] : other.caches)
+        {
+            Cache &copied = caches[width];
+            for (const auto &[text, lines] : cache.lines)
+            {
+                copied.lines.emplace(copied.keys.copy(text), lines);
+            }
+        }
+    }
+
+    TextWrapper &operator=(const TextWrapper &) = delete;
+
+    // The longest prefix of text that fits on one line, ending in "..." if
+    // anything was cut
+    string truncate(string_view text, float cell_width) const
+    {
+        Width width = measure(text.data(), text.size());
+        if (fits(width.units, cell_width))
+        {
+            return string(text);
+        }
+        uint32_t units = measure("...", 3).units;
+        size_t length = 0;
+        while (length < text.size() && fits(units + advances[static_cast<unsigned char>(text[length])], cell_width))
+        {
+            units += advances[static_cast<unsigned char>(text[length++])];
+        }
+        return string(text.substr(0, length)) + "...";
+    }
+
+    // Wrapped once per distinct text and width; the lines are shared by every
+    // row showing that text and stay valid as long as any of them holds them
+    shared_ptr<const vector<string>> wrapText(string_view text, float cell_width)
+    {
+        // Report values repeat a lot (status, command names, ...)
+        Cache &cache = caches[cell_width];
+        auto it = cache.lines.find(text);
+        if (it != cache.lines.end())
+        {
+            return it->second;
+        }
+        if (cache.lines.size() >= CACHE_LIMIT)
+        {
+            cache.lines.clear();
+            cache.keys = Arena();
+        }
+        auto lines = make_shared<const vector<string>>(wrap(text, cell_width));
+        cache.lines.emplace(cache.keys.copy(text), lines);
+        return lines;
+    }
+
+private:
+    static const size_t CACHE_LIMIT = 4096;
+
+    // Keys are views of copies in keys, so a lookup never builds a string
+    struct Cache
+    {
+        Arena keys{16 * 1024};
+        unordered_map<string_view, shared_ptr<const vector<string>>> lines;
+    };
+
+    // Text width in font units; measuring stops at a NUL byte, as it does
+    // for the C strings libharu is given
+    struct Width
+    {
+        uint32_t units = 0;
+        bool terminated = false;
+
+        void add(const Width &other)
+        {
+            if (!terminated)
+            {
+                units += other.units;
+                terminated = other.terminated;
+            }
+        }
+    };
+
+    float font_size;
+    uint32_t advances[256];
+    map<float, Cache> caches;
+    vector<uint32_t> prefix; // Scratch for splitWord
+
+    static bool is_space(char c)
+    {
+        // The separators istringstream >> string skips in the C locale
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    bool fits(uint32_t units, float cell_width) const
+    {
+        // Same float expression HPDF_Page_TextWidth evaluates
+        return static_cast<float>(units) * font_size / 1000 <= cell_width;
+    }
+
+    Width measure(const char *text, size_t length) const
+    {
+        Width width;
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (text[i] == '\0')
+            {
+                width.terminated = true;
+                break;
+            }
+            width.units += advances[static_cast<unsigned char>(text[i])];
+        }
+        return width;
+    }
+
+    vector<string> wrap(string_view text, float cell_width)
+    {
+        vector<string> lines;
+        string current_line;
+        Width current_width;
+        Width space_width = measure(" ", 1);
+
+        const char *p = text.data();
+        const char *end = p + text.size();
+        while (true)
+        {
+            while (p < end && is_space(*p))
+            {
+                ++p;
+            }
+            if (p == end)
+            {
+                break;
+            }
+            const char *word = p;
+            while (p < end && !is_space(*p))
+            {
+                ++p;
+            }
+            size_t word_length = p - word;
+
+            // If the current line + word fits in the cell width, add the word
+            Width test_width = current_width;
+            if (!current_line.empty())
+            {
+                test_width.add(space_width);
+            }
+            test_width.add(measure(word, word_length));
+            if (fits(test_width.units, cell_width))
+            {
+                if (!current_line.empty())
+                {
+                    current_line += ' ';
+                }
+                current_line.append(word, word_length);
+                current_width = test_width;
+                continue;
+            }
+
+            if (!current_line.empty())
+            {
+                lines.push_back(current_line);
+            }
+            current_line.clear();
+            current_width = Width();
+            splitWord(word, word_length, cell_width, lines);
+        }
+
+        if (!current_line.empty())
+        {
+            lines.push_back(current_line);
+        }
+        return lines;
+    }
+
+    // Emits the word as pieces of at most cell_width / 5 characters, each
+    // trimmed to the longest prefix that fits
+    void splitWord(const char *word, size_t length, float cell_width, vector<string> &lines)
+    {
+        prefix.resize(length + 1);
+        prefix[0] = 0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            prefix[i + 1] = prefix[i] + advances[static_cast<unsigned char>(word[i])];
+        }
+
+        const size_t chars_to_fit = static_cast<size_t>(cell_width / 5);
+        size_t start = 0;
+        while (start < length)
+        {
+            size_t limit = min(chars_to_fit, length - start);
+            const char *nul = static_cast<const char *>(memchr(word + start, '\0', limit));
+            size_t measured_end = nul ? nul - word : start + limit;
+
+            // Longest piece whose (NUL-terminated) width fits
+            size_t lo = 0, hi = limit;
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo + 1) / 2;
+                if (fits(prefix[min(start + mid, measured_end)] - prefix[start], cell_width))
+                {
+                    lo = mid;
+                }
+                else
+                {
+                    hi = mid - 1;
+                }
+            }
+
+            // A cell too narrow for a single glyph still has to make progress
+            size_t piece = max<size_t>(lo, 1);
+            lines.emplace_back(word + start, piece);
+            start += piece;
+        }
+    }
+};
+
+// Distinct values a report stores once; past this, values are copied per record
+static const size_t REPORT_INTERN_MAX = 1 << 16;
+
+// Splits [0, count) into at most `jobs` contiguous ranges (none smaller than
+// 256 items) and calls fn(thread_index, begin, end) for each, one per thread
+template <typename Fn>
+static void parallel_ranges(size_t count, size_t jobs, Fn fn)
+{
+    const size_t thread_count = max<size_t>(1, min(jobs, count / 256));
+    const size_t chunk = (count + thread_count - 1) / thread_count;
+    vector<thread> threads;
+    for (size_t t = 1; t < thread_count; ++t)
+    {
+        threads.emplace_back(fn, t, min(count, t * chunk), min(count, (t + 1) * chunk));
+    }
+    fn(0, 0, min(count, chunk));
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+}
+
+PDFDocument::PDFDocument(const string &filename, int fd)
+    : pdf(HPDF_New(error_handler, nullptr)), pdf_filename(filename), output_fd(fd), page_number(1)
+{
+    if (pdf == nullptr)
+    {
+        throw runtime_error("Failed to create PDF object.");
+    }
+    // Page contents are mostly repetitive text and rectangles; Flate shrinks them several times over
+    HPDF_SetCompressionMode(pdf, HPDF_COMP_ALL);
+    font = HPDF_GetFont(pdf, "Helvetica", nullptr);
+    page = HPDF_AddPage(pdf);
+    setupPage();
+
+    // Every page is A4 portrait
+    page_height = HPDF_Page_GetHeight(page);
+    float page_width = HPDF_Page_GetWidth(page);
+    key_col_width = (page_width - 2 * margin) * 0.2f;
+    value_col_width = (page_width - 2 * margin) * 0.8f;
+    text_wrapper.reset(new TextWrapper(font, font_size));
+}
+
+PDFDocument::~PDFDocument()
+{
+    HPDF_Free(pdf);
+}
+
+void PDFDocument::generatePDF(const vector<Record> &records)
+{
+    ReportPlan plan;
+    layout(records, plan, thread::hardware_concurrency());
+    render(records, plan, 0, plan.total_pages);
+}
+
+void PDFDocument::layout(const vector<Record> &records, ReportPlan &plan, size_t jobs, const ReportSummary *summary)
+{
+    plan.layouts.clear();
+    plan.layouts.resize(records.size());
+    measureEntries(records, plan, max<size_t>(1, jobs));
+
+    PageCursor cursor = startCursor();
+    plan.summary = SummaryLayout();
+    if (summary != nullptr)
+    {
+        layoutSummary(*summary, plan.summary, cursor);
+        if (!records.empty())
+        {
+            cursor = pageCursor(cursor.page + 1);
+        }
+    }
+    paginate(plan, cursor);
+}
+
+void PDFDocument::render(const vector<Record> &records, const ReportPlan &plan, int first_page, int end_page)
+{
+    beginPages(first_page, plan.total_pages);
+    drawSummary(plan.summary, first_page, end_page);
+    for (size_t i = plan.page_first_entry[first_page]; i < plan.layouts.size(); ++i)
+    {
+        if (!drawTableForEntry(records[i], plan.layouts[i], first_page, end_page))
+        {
+            break;
+        }
+    }
+    save();
+}
+
+void PDFDocument::beginPages(int first_page, int total_pages)
+{
+    this->total_pages = total_pages;
+    page_number = first_page + 1;
+    drawPageBorder();
+    drawPageNumber();
+    if (first_page == 0)
+    {
+        loadImagesAndText();
+    }
+}
+
+void PDFDocument::save()
+{
+    if (output_fd != -1)
+    {
+        write(output_fd);
+    }
+    else if (HPDF_SaveToFile(pdf, pdf_filename.c_str()) != HPDF_OK)
+    {
+        throw runtime_error("Failed to write PDF file: " + pdf_filename);
+    }
+}
+
+void PDFDocument::write(int fd)
+{
+    if (HPDF_SaveToStream(pdf) != HPDF_OK)
+    {
+        throw runtime_error("Failed to write PDF file: " + pdf_filename);
+    }
+    // Reading exactly the stream size never hits its end, which libharu
+    // would report through the error handler
+    HPDF_UINT32 remaining = HPDF_GetStreamSize(pdf);
+    vector<HPDF_BYTE> buffer(256 * 1024);
+    while (remaining > 0)
+    {
+        HPDF_UINT32 size = min<HPDF_UINT32>(remaining, buffer.size());
+        if (HPDF_ReadFromStream(pdf, buffer.data(), &size) != HPDF_OK || size == 0)
+        {
+            throw runtime_error("Failed to write PDF file: " + pdf_filename);
+        }
+        remaining -= size;
+        for (HPDF_UINT32 done = 0; done < size;)
+        {
+            ssize_t n = ::write(fd, buffer.data() + done, size - done);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw runtime_error("Failed to write PDF file " + pdf_filename + ": " + strerror(errno));
+            }
+            done += n;
+        }
+    }
+}
+
+void PDFDocument::error_handler(HPDF_STATUS error_no, HPDF_STATUS detail_no, void *user_data)
+{
+    cerr << "ERROR: " << error_no << ", DETAIL: " << detail_no << endl;
+}
+
+void PDFDocument::setupPage()
+{
+    HPDF_Page_SetSize(page, HPDF_PAGE_SIZE_A4, HPDF_PAGE_PORTRAIT);
+    HPDF_Page_SetFontAndSize(page, font, font_size);
+}
+
+void PDFDocument::addNewPage()
+{
+    page = HPDF_AddPage(pdf);
+    setupPage();
+    drawPageBorder();
+    drawPageNumber();
+}
+
+// Measures records on all cores. Each thread has its own wrapper (wrap
+// caches are not shared); results land at the record's index.
+void PDFDocument::measureEntries(const vector<Record> &records, ReportPlan &plan, size_t jobs)
+{
+    parallel_ranges(records.size(), jobs, [&](size_t, size_t begin, size_t end)
+                    {
+        TextWrapper wrapper(*text_wrapper);
+        for (size_t i = begin; i < end; ++i)
+        {
+            measureEntry(records[i], wrapper, plan.layouts[i]);
+        } });
+}
+
+void PDFDocument::measureEntry(const Record &entry, TextWrapper &wrapper, EntryLayout &layout)
+{
+    for (size_t i = 0; i < Record::FIELD_COUNT; ++i)
+    {
+        const RecordField &field = entry.fields[i];
+        if (field.kind == FieldKind::Missing)
+        {
+            continue;
+        }
+
+        RowLayout row;
+        row.field = static_cast<uint8_t>(i);
+        row.page = 0;
+        row.y = 0.0f;
+        if (field.kind == FieldKind::String)
+        {
+            // Taller of the key and the wrapped value
+            row.value_lines = wrapper.wrapText(field.str(), value_col_width - 2 * cell_padding); // Respect padding
+            row.height = max(cellHeight(*wrapper.wrapText(Record::FIELD_NAMES[i], key_col_width - 2 * cell_padding)),
+                             cellHeight(*row.value_lines));
+        }
+        else
+        {
+            // Each list item counts as a row wrapped to the key column
+            row.height = 0.0f;
+            for (const auto &item : field)
+            {
+                row.height += cellHeight(*wrapper.wrapText(item, key_col_width - 2 * cell_padding));
+            }
+        }
+        layout.rows.push_back(move(row));
+    }
+}
+
+float PDFDocument::cellHeight(const vector<string> &wrapped) const
+{
+    return (wrapped.size() * line_height) + 2 * cell_padding; // Text height + padding
+}
+
+// Serial pass over the measured heights, from cursor on (pages before it
+// hold no entries)
+void PDFDocument::paginate(ReportPlan &plan, PageCursor cursor) const
+{
+    plan.page_first_entry.assign(cursor.page + 1, 0);
+    for (size_t i = 0; i < plan.layouts.size(); ++i)
+    {
+        uint32_t breaks = placeEntry(plan.layouts[i], cursor);
+        plan.page_first_entry.insert(plan.page_first_entry.end(), breaks, i);
+    }
+    plan.total_pages = cursor.page + 1;
+}
+
+PageCursor PDFDocument::startCursor() const
+{
+    PageCursor cursor;
+    cursor.y = page_height - margin - title_height;
+    return cursor;
+}
+
+PageCursor PDFDocument::pageCursor(uint32_t page) const
+{
+    PageCursor cursor;
+    cursor.page = page;
+    cursor.y = page_height - margin;
+    return cursor;
+}
+
+// Returns the number of page breaks taken
+uint32_t PDFDocument::placeEntry(EntryLayout &layout, PageCursor &cursor) const
+{
+    uint32_t breaks = 0;
+    for (auto &row : layout.rows)
+    {
+        // A row taller than a page still gets a page of its own
+        if (cursor.y - row.height < margin)
+        {
+            cursor.page++;
+            cursor.y = page_height - margin;
+            breaks++;
+        }
+        row.page = cursor.page;
+        row.y = cursor.y;
+        cursor.y -= row.height;
+    }
+    cursor.y -= entry_spacing; // Space between tables
+    return breaks;
+}
+
+void PDFDocument::layoutEntry(const Record &record, EntryLayout &layout, PageCursor &cursor)
+{
+    layout.rows.clear();
+    measureEntry(record, *text_wrapper, layout);
+    placeEntry(layout, cursor);
+}
+
+static string format_count(uint64_t count)
+{
+    return to_string(count);
+}
+
+static string format_share(uint64_t part, uint64_t whole)
+{
+    if (whole == 0)
+    {
+        return "-";
+    }
+    char text[16];
+    snprintf(text, sizeof(text), "%.1f%%", 100.0 * part / whole);
+    return text;
+}
+
+static string format_time(uint64_t ns)
+{
+    time_t seconds = static_cast<time_t>(ns / 1000000000);
+    tm utc;
+    gmtime_r(&seconds, &utc);
+    char text[32];
+    size_t length = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &utc);
+    snprintf(text + length, sizeof(text) - length, ".%03u", static_cast<unsigned>(ns / 1000000 % 1000));
+    return text;
+}
+
+static string format_duration(uint64_t ns)
+{
+    char text[32];
+    if (ns >= 1000000000)
+    {
+        snprintf(text, sizeof(text), "%.1f s", ns / 1e9);
+    }
+    else if (ns >= 1000000)
+    {
+        snprintf(text, sizeof(text), "%.1f ms", ns / 1e6);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "%.1f us", ns / 1e3);
+    }
+    return text;
+}
+
+static string format_value(const string &value)
+{
+    return value.empty() ? "(none)" : value;
+}
+
+// The summary's tables, with column widths as fractions of the page
+static vector<SummaryTable> summary_tables(const ReportSummary &summary)
+{
+    vector<SummaryTable> tables;
+    const uint64_t other = summary.records - summary.passed - summary.failed;
+
+    SummaryTable overview{"Summary", {0.5f, 0.5f}, {{"Measure", "Value"}}};
+    overview.rows.push_back({"Records", format_count(summary.records)});
+    overview.rows.push_back({"Passed", format_count(summary.passed) + " (" + format_share(summary.passed, summary.records) + ")"});
+    overview.rows.push_back({"Failed", format_count(summary.failed) + " (" + format_share(summary.failed, summary.records) + ")"});
+    overview.rows.push_back({"Other", format_count(other) + " (" + format_share(other, summary.records) + ")"});
+    overview.rows.push_back({"Distinct statuses", format_count(summary.statuses)});
+    overview.rows.push_back({"Distinct commands", format_count(summary.commands)});
+    if (summary.untimed > 0)
+    {
+        overview.rows.push_back({"Without receive time", format_count(summary.untimed)});
+    }
+    tables.push_back(move(overview));
+
+    if (!summary.by_status.empty())
+    {
+        SummaryTable table{"Records by status", {0.5f, 0.25f, 0.25f}, {{"Status", "Records", "Share"}}};
+        uint64_t shown = 0;
+        for (const auto &row : summary.by_status)
+        {
+            table.rows.push_back({format_value(row.value), format_count(row.records), format_share(row.records, summary.records)});
+            shown += row.records;
+        }
+        if (summary.statuses > summary.by_status.size())
+        {
+            const uint64_t rest = summary.records - shown;
+            table.rows.push_back({"(" + to_string(summary.statuses - summary.by_status.size()) + " more)",
+                                  format_count(rest), format_share(rest, summary.records)});
+        }
+        tables.push_back(move(table));
+    }
+
+    if (!summary.by_command.empty())
+    {
+        SummaryTable table{"Records by command", {0.4f, 0.2f, 0.2f, 0.2f}, {{"Command", "Records", "Failed", "Failure rate"}}};
+        for (const auto &row : summary.by_command)
+        {
+            table.rows.push_back({format_value(row.value), format_count(row.records), format_count(row.failed),
+                                  format_share(row.failed, row.records)});
+        }
+        if (summary.commands > summary.by_command.size())
+        {
+            table.rows.push_back({"(" + to_string(summary.commands - summary.by_command.size()) + " more)", "", "", ""});
+        }
+        tables.push_back(move(table));
+    }
+
+    if (!summary.failing.empty())
+    {
+        SummaryTable table{"Most failing commands", {0.4f, 0.2f, 0.2f, 0.2f}, {{"Command", "Failed", "Records", "Failure rate"}}};
+        for (const auto &row : summary.failing)
+        {
+            table.rows.push_back({format_value(row.value), format_count(row.failed), format_count(row.records),
+                                  format_share(row.failed, row.records)});
+        }
+        tables.push_back(move(table));
+    }
+
+    if (!summary.timeline.empty())
+    {
+        const SummaryBucket &first = summary.timeline.front();
+        SummaryTable table{"Results over time, " + format_duration(first.to_ns - first.from_ns) + " per row",
+                           {0.34f, 0.14f, 0.14f, 0.14f, 0.24f},
+                           {{"Received from (UTC)", "Passed", "Failed", "Other", "Pass rate"}}};
+        for (const auto &bucket : summary.timeline)
+        {
+            table.rows.push_back({format_time(bucket.from_ns), format_count(bucket.passed), format_count(bucket.failed),
+                                  format_count(bucket.other), format_share(bucket.passed, bucket.passed + bucket.failed)});
+        }
+        tables.push_back(move(table));
+    }
+    return tables;
+}
+
+// Rows are one line each; a cell too long for its column is cut short. A
+// table starts on a new page unless its title, column names and first row
+// fit, and gets its column names again on every page it continues onto.
+void PDFDocument::layoutSummary(const ReportSummary &summary, SummaryLayout &layout, PageCursor &cursor) const
+{
+    layout.tables = summary_tables(summary);
+    layout.lines.clear();
+    const float table_width = key_col_width + value_col_width;
+    for (uint32_t t = 0; t < layout.tables.size(); ++t)
+    {
+        SummaryTable &table = layout.tables[t];
+        for (float &width : table.widths)
+        {
+            width *= table_width;
+        }
+        for (auto &cells : table.rows)
+        {
+            for (size_t c = 0; c < cells.size(); ++c)
+            {
+                cells[c] = text_wrapper->truncate(cells[c], table.widths[c] - 2 * cell_padding);
+            }
+        }
+
+        if (cursor.y - summary_title_height - 2 * summary_row_height < margin)
+        {
+            cursor = pageCursor(cursor.page + 1);
+        }
+        layout.lines.push_back({cursor.page, cursor.y, t, -1});
+        cursor.y -= summary_title_height;
+        for (int32_t row = 0; row < static_cast<int32_t>(table.rows.size()); ++row)
+        {
+            if (cursor.y - summary_row_height < margin)
+            {
+                cursor = pageCursor(cursor.page + 1);
+                layout.lines.push_back({cursor.page, cursor.y, t, 0});
+                cursor.y -= summary_row_height;
+            }
+            layout.lines.push_back({cursor.page, cursor.y, t, row});
+            cursor.y -= summary_row_height;
+        }
+        cursor.y -= entry_spacing;
+    }
+}
+
+// The border is the same on every page, so it is drawn once, into a content
+// stream of its own, and later pages only refer to that stream
+void PDFDocument::drawPageBorder()
+{
+    if (page_border != nullptr)
+    {
+        HPDF_Page_Insert_Shared_Content_Stream(page, page_border);
+        return;
+    }
+
+    float page_width = HPDF_Page_GetWidth(page);
+    HPDF_Page_New_Content_Stream(page, &page_border);
+    HPDF_Page_SetLineWidth(page, 2.0f);
+    HPDF_Page_Rectangle(page, margin - 5.0f, margin - 5.0f,
+                        page_width - 2 * margin + 10.0f,
+                        page_height - 2 * margin + 10.0f);
+    HPDF_Page_Stroke(page);
+
+    // The rest of the page goes in a stream of its own
+    HPDF_Dict contents;
+    HPDF_Page_New_Content_Stream(page, &contents);
+}
+
+// Text is drawn in as few text objects as possible: one per row or cell
+// group, with each line positioned relative to the one before
+void PDFDocument::beginText(float size)
+{
+    HPDF_Page_BeginText(page);
+    HPDF_Page_SetFontAndSize(page, font, size);
+    text_x = 0.0f;
+    text_y = 0.0f;
+}
+
+void PDFDocument::showText(float x, float y, const char *text)
+{
+    HPDF_Page_MoveTextPos(page, x - text_x, y - text_y);
+    HPDF_Page_ShowText(page, text);
+    text_x = x;
+    text_y = y;
+}
+
+void PDFDocument::endText()
+{
+    HPDF_Page_EndText(page);
+}
+
+void PDFDocument::loadImagesAndText()
+{
+    loadImage("left_image.jpeg", margin, HPDF_Page_GetHeight(page) - 110.0f);
+    loadImage("right_image.jpeg", HPDF_Page_GetWidth(page) - margin - 60.0f, HPDF_Page_GetHeight(page) - 110.0f);
+
+    const string centered_text = "Name_Head";
+    float page_width = HPDF_Page_GetWidth(page);
+    beginText(20.0f);
+    float text_width = HPDF_Page_TextWidth(page, centered_text.c_str());
+    float text_x_position = (page_width / 2) - (text_width / 2);
+    float text_y_position = HPDF_Page_GetHeight(page) - 70.0f;
+    showText(text_x_position, text_y_position, centered_text.c_str());
+    endText();
+}
+
+void PDFDocument::loadImage(const string &filename, float x, float y)
+{
+    HPDF_Image img = HPDF_LoadJpegImageFromFile(pdf, filename.c_str());
+    if (img != nullptr)
+    {
+        HPDF_Page_DrawImage(page, img, x, y, 60.0f, 60.0f);
+    }
+    else
+    {
+        cerr << "Warning: Could not load image " << filename << endl;
+    }
+}
+
+void PDFDocument::drawPageNumber()
+{
+    beginText(12.0f);
+    stringstream page_num_str;
+    page_num_str << "Page " << page_number << " of " << total_pages;
+    float page_width = HPDF_Page_GetWidth(page);
+    float text_width = HPDF_Page_TextWidth(page, page_num_str.str().c_str());
+    showText((page_width / 2) - (text_width / 2), margin - 20.0f, page_num_str.str().c_str());
+    endText();
+    page_number++;
+}
+
+void PDFDocument::drawArrayRowWithBorder(const string &key, const RecordField &array_data, float y_position, float total_cell_height)
+{
+    float x_position = margin;
+    const float light_pink[] = {1.0f, 0.8f, 0.8f}; // Light pink color
+
+    // Set background color for key column (light pink)
+    HPDF_Page_SetRGBFill(page, light_pink[0], light_pink[1], light_pink[2]);
+    HPDF_Page_Rectangle(page, x_position, y_position - total_cell_height, key_col_width, total_cell_height); // Key column background
+    HPDF_Page_Fill(page);
+
+    // Draw the borders around the key and value columns
+    HPDF_Page_SetLineWidth(page, 1.0f);
+    HPDF_Page_Rectangle(page, x_position, y_position - total_cell_height, key_col_width, total_cell_height); // Key column border
+    HPDF_Page_Rectangle(page, x_position + key_col_width, y_position - total_cell_height, value_col_width, total_cell_height); // Value column border
+    HPDF_Page_Stroke(page);
+
+    // Print the key (once), then the array values inside the value column
+    // (no background fill, just text and border), in one text object
+    HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f); // Black color for text
+    beginText(font_size);
+    showText(x_position + cell_padding, y_position - cell_padding - line_height, key.c_str());
+
+    x_position += key_col_width;
+    float text_y_position = y_position - cell_padding - line_height;
+    string array_item;
+    for (const auto &item : array_data)
+    {
+        array_item.assign(item.data(), item.size()); // ShowText needs a C string
+        showText(x_position + cell_padding, text_y_position, array_item.c_str());
+        text_y_position -= line_height + cell_padding; // Move down for the next array item
+    }
+    endText();
+}
+
+// Render pass: positions and line breaks all come from the plan. Rows
+// outside [first_page, end_page) belong to other shards; returns false
+// once the range has been drawn.
+bool PDFDocument::drawTableForEntry(const Record &entry, const EntryLayout &layout, int first_page, int end_page)
+{
+    for (const auto &row : layout.rows)
+    {
+        if (row.page < static_cast<uint32_t>(first_page))
+        {
+            continue;
+        }
+        if (row.page >= static_cast<uint32_t>(end_page))
+        {
+            return false;
+        }
+
+        // page_number is the number the next page will get
+        while (static_cast<uint32_t>(page_number - 1) <= row.page)
+        {
+            addNewPage();
+        }
+
+        const string key = Record::FIELD_NAMES[row.field];
+        if (entry.fields[row.field].kind == FieldKind::String)
+        {
+            auto key_lines = text_wrapper->wrapText(key, key_col_width - 2 * cell_padding);
+            drawRow(*key_lines, *row.value_lines, row.y, row.height);
+        }
+        // Print key once, no individual borders for array items, but border for the whole block
+        else
+        {
+            drawArrayRowWithBorder(key, entry.fields[row.field], row.y, row.height);
+        }
+    }
+    return true;
+}
+
+bool PDFDocument::drawSummary(const SummaryLayout &layout, int first_page, int end_page)
+{
+    for (const auto &line : layout.lines)
+    {
+        if (line.page < static_cast<uint32_t>(first_page))
+        {
+            continue;
+        }
+        if (line.page >= static_cast<uint32_t>(end_page))
+        {
+            return false;
+        }
+        while (static_cast<uint32_t>(page_number - 1) <= line.page)
+        {
+            addNewPage();
+        }
+        drawSummaryLine(layout.tables[line.table], line.row, line.y);
+    }
+    return true;
+}
+
+void PDFDocument::drawSummaryLine(const SummaryTable &table, int32_t row, float y_position)
+{
+    if (row < 0)
+    {
+        beginText(14.0f);
+        showText(margin, y_position - summary_title_height + 10.0f, table.title.c_str());
+        endText();
+        return;
+    }
+
+    const float light_pink[] = {1.0f, 0.8f, 0.8f};
+    const auto &cells = table.rows[row];
+    const float bottom = y_position - summary_row_height;
+    if (row == 0)
+    {
+        // Column names, shaded like the keys of the entries
+        HPDF_Page_SetRGBFill(page, light_pink[0], light_pink[1], light_pink[2]);
+        HPDF_Page_Rectangle(page, margin, bottom, key_col_width + value_col_width, summary_row_height);
+        HPDF_Page_Fill(page);
+    }
+    HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f);
+    HPDF_Page_SetLineWidth(page, 1.0f);
+    float x_position = margin;
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+        HPDF_Page_Rectangle(page, x_position, bottom, table.widths[i], summary_row_height);
+        x_position += table.widths[i];
+    }
+    HPDF_Page_Stroke(page);
+
+    beginText(font_size);
+    x_position = margin;
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+        showText(x_position + cell_padding, bottom + (summary_row_height - font_size) / 2 + 2.0f, cells[i].c_str());
+        x_position += table.widths[i];
+    }
+    endText();
+}
+
+void PDFDocument::drawRow(const vector<string> &key_lines, const vector<string> &value_lines, float y_position, float max_cell_height)
+{
+    const float light_pink[] = {1.0f, 0.8f, 0.8f};
+    HPDF_Page_SetRGBFill(page, light_pink[0], light_pink[1], light_pink[2]);
+    HPDF_Page_Rectangle(page, margin, y_position - max_cell_height, key_col_width, max_cell_height);
+    HPDF_Page_Fill(page); // Fill the key cell with light pink
+    HPDF_Page_SetRGBFill(page, 0.0f, 0.0f, 0.0f); // Reset to black for text
+    HPDF_Page_SetLineWidth(page, 1.0f);
+    HPDF_Page_Rectangle(page, margin, y_position - max_cell_height, key_col_width, max_cell_height);
+    HPDF_Page_Rectangle(page, margin + key_col_width, y_position - max_cell_height, value_col_width, max_cell_height);
+    HPDF_Page_Stroke(page); // Both borders at once
+
+    // Both cells' lines in one text object
+    beginText(font_size);
+    float x_position = margin;
+    const vector<string> *columns[] = {&key_lines, &value_lines};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        float text_y_position = y_position - cell_padding - line_height;
+        for (const auto &line : *columns[i])
+        {
+            showText(x_position + cell_padding, text_y_position, line.c_str());
+            text_y_position -= line_height;
+        }
+        x_position += key_col_width; // To the value column
+    }
+    endText();
+}
+
+string shardPath(const string &output, size_t index)
+{
+    filesystem::path path(output);
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "-%04zu", index + 1);
+    path.replace_filename(path.stem().string() + suffix + path.extension().string());
+    return path.string();
+}
+
+static size_t job_count(const RenderOptions &options)
+{
+    return options.jobs > 0 ? options.jobs : max(1u, thread::hardware_concurrency());
+}
+
+// Shards are files; only a whole report can go to a descriptor
+static void check_output(const RenderOptions &options)
+{
+    if (options.fd != -1 && options.split)
+    {
+        throw runtime_error("Split reports cannot be written to a file descriptor");
+    }
+}
+
+// What a report written to output returns
+static vector<string> written_files(const string &output, const RenderOptions &options)
+{
+    return options.fd != -1 ? vector<string>() : vector<string>{output};
+}
+
+// Merges the shards into output (or fd) and removes them; on failure they are kept
+static void mergeShards(const vector<string> &paths, const string &output, int fd)
+{
+    try
+    {
+        if (fd != -1)
+        {
+            mergePdfFiles(paths, fd);
+        }
+        else
+        {
+            mergePdfFiles(paths, output);
+        }
+    }
+    catch (const runtime_error &e)
+    {
+        throw runtime_error(string(e.what()) + " (the shards are left in " + paths.front() + " to " + paths.back() + ")");
+    }
+    for (const auto &path : paths)
+    {
+        filesystem::remove(path);
+    }
+}
+
+// The columns are filled on all cores; the scan itself is serial
+static ReportSummary summarize_records(const vector<Record> &records, const RenderOptions &options, size_t jobs)
+{
+    RecordColumns columns;
+    columns.resize(records.size());
+    parallel_ranges(records.size(), jobs, [&](size_t, size_t begin, size_t end)
+                    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            columns.set(i, records[i]);
+        } });
+    return summarize(columns, options.summary_options);
+}
+
+vector<string> generateReport(const vector<Record> &all_records, const string &output, const RenderOptions &options)
+{
+    check_output(options);
+    const size_t jobs = job_count(options);
+
+    ReportSummary summary;
+    if (options.summary != SummaryMode::Off)
+    {
+        summary = summarize_records(all_records, options, jobs);
+    }
+    static const vector<Record> no_records;
+    const vector<Record> &records = options.summary == SummaryMode::Only ? no_records : all_records;
+
+    ReportPlan plan;
+    PDFDocument planner(output, options.fd);
+    planner.layout(records, plan, jobs, options.summary != SummaryMode::Off ? &summary : nullptr);
+
+    const int shard_pages = options.shard_pages > 0 ? options.shard_pages : plan.total_pages;
+    const size_t shard_count = (plan.total_pages + shard_pages - 1) / shard_pages;
+    if (shard_count == 1 && !options.split)
+    {
+        planner.render(records, plan, 0, plan.total_pages);
+        return written_files(output, options);
+    }
+
+    vector<string> paths;
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        paths.push_back(shardPath(output, i));
+    }
+
+    atomic<size_t> next_shard{0};
+    mutex error_mutex;
+    exception_ptr error;
+    auto renderShards = [&]()
+    {
+        for (size_t i = next_shard++; i < shard_count; i = next_shard++)
+        {
+            try
+            {
+                PDFDocument shard(paths[i]);
+                shard.render(records, plan, i * shard_pages, min<int>(plan.total_pages, (i + 1) * shard_pages));
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = current_exception();
+                }
+                next_shard = shard_count; // Stop handing out shards
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t t = 1; t < min(jobs, shard_count); ++t)
+    {
+        threads.emplace_back(renderShards);
+    }
+    renderShards();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    if (error)
+    {
+        rethrow_exception(error);
+    }
+
+    if (options.split)
+    {
+        return paths;
+    }
+    mergeShards(paths, output, options.fd);
+    return written_files(output, options);
+}
+
+vector<string> generateReport(const json &entries, const string &output, const RenderOptions &options)
+{
+    // Each thread converts a contiguous range into its own arena; repeated
+    // values are stored once, in the shared interner
+    vector<Record> records(entries.size());
+    vector<Arena> arenas(job_count(options));
+    StringInterner interner(REPORT_INTERN_MAX);
+    parallel_ranges(entries.size(), arenas.size(), [&](size_t t, size_t begin, size_t end)
+                    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            Record::fromJson(entries[i], arenas[t], records[i], &interner); // Non-objects give an empty record
+        } });
+    return generateReport(records, output, options);
+}
+
+vector<string> streamReport(const RecordReader &read, const string &output, const RenderOptions &options)
+{
+    check_output(options);
+    PDFDocument planner(output);
+    EntryLayout layout;
+    const bool with_summary = options.summary != SummaryMode::Off;
+    const bool with_entries = options.summary != SummaryMode::Only;
+
+    // First pass: the page count, which every footer shows, and the columns
+    // the summary is computed from. With a summary the entries start on a
+    // page of their own, so they are counted from the top of one.
+    unique_ptr<RecordColumns> columns(with_summary ? new RecordColumns : nullptr);
+    size_t entry_count = 0;
+    PageCursor cursor = with_summary ? planner.pageCursor(0) : planner.startCursor();
+    read([&](const Record &record)
+         {
+        if (columns)
+        {
+            columns->push_back(record);
+        }
+        if (with_entries)
+        {
+            planner.layoutEntry(record, layout, cursor);
+            entry_count++;
+        } });
+
+    PageCursor start = planner.startCursor();
+    SummaryLayout summary_layout;
+    int total_pages = cursor.page + 1;
+    if (with_summary)
+    {
+        planner.layoutSummary(summarize(*columns, options.summary_options), summary_layout, start);
+        columns.reset();
+        total_pages = start.page + 1;
+        if (entry_count > 0)
+        {
+            start = planner.pageCursor(start.page + 1);
+            total_pages = start.page + cursor.page + 1;
+        }
+    }
+
+    const int shard_pages = options.shard_pages > 0 ? options.shard_pages : total_pages;
+    const size_t shard_count = (total_pages + shard_pages - 1) / shard_pages;
+    const bool single = shard_count == 1 && !options.split;
+    vector<string> paths;
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        paths.push_back(single ? output : shardPath(output, i));
+    }
+
+    // Second pass: lay each record out again and draw it. A shard is saved
+    // (and freed) as soon as a row lands past its last page.
+    unique_ptr<PDFDocument> shard;
+    size_t shard_index = 0;
+    auto openShard = [&](size_t i)
+    {
+        if (i >= shard_count)
+        {
+            throw runtime_error("Input changed while the report was rendered");
+        }
+        shard.reset(new PDFDocument(paths[i], single ? options.fd : -1));
+        shard->beginPages(i * shard_pages, total_pages);
+    };
+    auto shardEnd = [&]()
+    { return min<int>(total_pages, (shard_index + 1) * shard_pages); };
+    openShard(0);
+    while (!shard->drawSummary(summary_layout, shard_index * shard_pages, shardEnd()))
+    {
+        shard->save();
+        openShard(++shard_index);
+    }
+    cursor = start;
+    if (with_entries)
+    {
+        read([&](const Record &record)
+             {
+            planner.layoutEntry(record, layout, cursor);
+            while (!shard->drawTableForEntry(record, layout, shard_index * shard_pages, shardEnd()))
+            {
+                shard->save();
+                openShard(++shard_index);
+            } });
+    }
+    shard->save();
+    shard.reset();
+    if (shard_index + 1 != shard_count)
+    {
+        throw runtime_error("Input changed while the report was rendered");
+    }
+
+    if (options.split)
+    {
+        return paths;
+    }
+    if (single)
+    {
+        return written_files(output, options);
+    }
+    mergeShards(paths, output, options.fd);
+    return written_files(output, options);
+}
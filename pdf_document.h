@@ -0,0 +1,210 @@
+#ifndef PDF_DOCUMENT_H
+#define PDF_DOCUMENT_H
+
+#include <hpdf.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "record.h"
+#include "report_summary.h"
+
+class TextWrapper;
+
+// One table row after measuring: which field it shows, its wrapped value and
+// its height. Pagination then fills in the page and the top edge, so drawing
+// needs no measuring at all.
+struct RowLayout
+{
+    uint8_t field;                        // Index into Record::fields
+    uint32_t page;                        // Zero-based
+    float y;                              // Top edge of the row
+    float height;
+    std::shared_ptr<const std::vector<std::string>> value_lines; // Wrapped string value, shared by equal values; null for lists
+};
+
+struct EntryLayout
+{
+    std::vector<RowLayout> rows;
+};
+
+// A summary table, formatted: its column widths and the text of each row,
+// column names first
+struct SummaryTable
+{
+    std::string title;
+    std::vector<float> widths;
+    std::vector<std::vector<std::string>> rows;
+};
+
+// A line of the summary section placed on its page
+struct SummaryLine
+{
+    uint32_t page;  // Zero-based
+    float y;        // Top edge
+    uint32_t table; // Index into SummaryLayout::tables
+    int32_t row;    // -1 for the title, 0 for the column names (repeated on every page), then the data
+};
+
+struct SummaryLayout
+{
+    std::vector<SummaryTable> tables;
+    std::vector<SummaryLine> lines;
+};
+
+// Everything rendering needs besides the records themselves, built once for
+// the whole report. Any range of pages can be rendered from it on its own,
+// which is what sharding relies on.
+struct ReportPlan
+{
+    SummaryLayout summary;                // Empty without a summary section
+    std::vector<EntryLayout> layouts;     // One per record
+    std::vector<size_t> page_first_entry; // First record with a row on each page
+    int total_pages = 1;
+};
+
+// Where pagination will put the next row
+struct PageCursor
+{
+    uint32_t page = 0;
+    float y = 0.0f;
+};
+
+// Lays a report out in two passes: records are measured in parallel into a
+// page plan (line breaks, row heights, page breaks), and a serial pass then
+// only draws from the plan. Since the page count is known before anything is
+// drawn, footers read "Page X of Y".
+class PDFDocument
+{
+public:
+    // save() writes the document to filename, or to fd if one is given
+    // (filename then only names it in errors)
+    explicit PDFDocument(const std::string &filename, int fd = -1);
+    ~PDFDocument();
+
+    PDFDocument(const PDFDocument &) = delete;
+    PDFDocument &operator=(const PDFDocument &) = delete;
+
+    // Lays out and renders every record into this document's file
+    void generatePDF(const std::vector<Record> &records);
+
+    // Measures and paginates every record, using up to jobs threads. With a
+    // summary, its tables come first and the records start on a new page.
+    void layout(const std::vector<Record> &records, ReportPlan &plan, size_t jobs,
+                const ReportSummary *summary = nullptr);
+
+    // Draws pages [first_page, end_page) of the plan, numbered as in the
+    // whole report, and saves them. records must be the ones laid out.
+    void render(const std::vector<Record> &records, const ReportPlan &plan, int first_page, int end_page);
+
+    // The same steps one record at a time, for streaming (see streamReport).
+    // layoutEntry measures and places a record's rows from cursor on;
+    // beginPages starts this document at first_page; drawTableForEntry draws
+    // the rows on pages [first_page, end_page) and returns false if some row
+    // lies beyond them; save writes the file.
+    PageCursor startCursor() const;
+    void layoutEntry(const Record &record, EntryLayout &layout, PageCursor &cursor);
+    void beginPages(int first_page, int total_pages);
+    bool drawTableForEntry(const Record &entry, const EntryLayout &layout, int first_page, int end_page);
+    void save();
+
+    // Writes the document to fd, which may be a pipe or socket: libharu
+    // serializes it to a memory stream, copied out in blocks
+    void write(int fd);
+
+    // Likewise for the summary section: layoutSummary formats the tables and
+    // places their lines from cursor on; drawSummary draws the lines on pages
+    // [first_page, end_page) and returns false if some line lies beyond them.
+    // pageCursor is the top of an empty page.
+    void layoutSummary(const ReportSummary &summary, SummaryLayout &layout, PageCursor &cursor) const;
+    bool drawSummary(const SummaryLayout &layout, int first_page, int end_page);
+    PageCursor pageCursor(uint32_t page) const;
+
+private:
+    HPDF_Doc pdf;
+    HPDF_Page page;
+    HPDF_Font font;
+    std::string pdf_filename;
+    int output_fd;
+    HPDF_Dict page_border = nullptr; // Content stream shared by every page
+    float font_size = 12.0f;
+    float margin = 50.0f;
+    float line_height = 18.0f;
+    float cell_padding = 10.0f; // Increased padding
+    float title_height = 80.0f; // Images and title on the first page
+    float entry_spacing = 20.0f;
+    float summary_row_height = 22.0f;
+    float summary_title_height = 30.0f;
+    float page_height;
+    float key_col_width;
+    float value_col_width;
+    int page_number;
+    int total_pages = 1;
+    float text_x = 0.0f; // Start of the last line shown in the open text object
+    float text_y = 0.0f;
+    std::unique_ptr<TextWrapper> text_wrapper;
+
+    static void error_handler(HPDF_STATUS error_no, HPDF_STATUS detail_no, void *user_data);
+
+    void setupPage();
+    void addNewPage();
+    void measureEntries(const std::vector<Record> &records, ReportPlan &plan, size_t jobs);
+    void measureEntry(const Record &entry, TextWrapper &wrapper, EntryLayout &layout);
+    float cellHeight(const std::vector<std::string> &wrapped) const;
+    void paginate(ReportPlan &plan, PageCursor cursor) const;
+    uint32_t placeEntry(EntryLayout &layout, PageCursor &cursor) const;
+    void drawPageBorder();
+    void beginText(float size);
+    void showText(float x, float y, const char *text);
+    void endText();
+    void loadImagesAndText();
+    void loadImage(const std::string &filename, float x, float y);
+    void drawPageNumber();
+    void drawArrayRowWithBorder(const std::string &key, const RecordField &array_data, float y_position, float total_cell_height);
+    void drawRow(const std::vector<std::string> &key_lines, const std::vector<std::string> &value_lines, float y_position, float max_cell_height);
+    void drawSummaryLine(const SummaryTable &table, int32_t row, float y_position);
+};
+
+struct RenderOptions
+{
+    size_t jobs = 0;       // Threads; 0 means one per core
+    int shard_pages = 256; // Pages per independently rendered document; 0 disables sharding
+    bool split = false;    // Leave the shards as numbered files instead of merging them
+    int fd = -1;           // Write the report here (stdout, a pipe, ...); output then only names the shards
+    SummaryMode summary = SummaryMode::Off;
+    SummaryOptions summary_options;
+};
+
+// "report.pdf" -> "report-0003.pdf" for the third shard
+std::string shardPath(const std::string &output, size_t index);
+
+// Renders records into output. The report is laid out once, then rendered in
+// shards of shard_pages pages, each an independent libharu document on a
+// worker thread, so wall time scales with cores and at most `jobs` shards are
+// held in memory at once. Unless split is set, the shards are merged into
+// output (or fd). Returns the files written (none with fd); throws runtime_error
+// on failure.
+std::vector<std::string> generateReport(const std::vector<Record> &records, const std::string &output,
+                                        const RenderOptions &options = RenderOptions());
+
+// Same, for JSON entries (converted to records in parallel first)
+std::vector<std::string> generateReport(const nlohmann::json &entries, const std::string &output,
+                                        const RenderOptions &options = RenderOptions());
+
+// Hands every record of an input to visit, in order. A record only has to
+// stay valid during its call. Must produce the same records every time.
+using RecordReader = std::function<void(const std::function<void(const Record &)> &visit)>;
+
+// Same output as generateReport, in memory that does not grow with the input:
+// records are read twice, once to count pages (for the footers) and once to
+// draw them, and only one record plus one shard of shard_pages pages is held
+// at a time (a summary adds the columns it is computed from, 16 bytes a
+// record). Each shard is written out as soon as its last page is drawn.
+// Serial, so jobs is ignored.
+std::vector<std::string> streamReport(const RecordReader &read, const std::string &output,
+                                      const RenderOptions &options = RenderOptions());
+
+#endif
@@ -0,0 +1,606 @@
+#include "pdf_merge.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    // What the merge needs to know about one input, gathered in a first pass
+    struct SourceFile
+    {
+        string path;
+        map<uint32_t, size_t> offsets; // Object id -> byte offset of "id gen obj"
+        vector<size_t> boundaries;     // Every object offset plus the xref offset, sorted
+        size_t xref_offset = 0;
+        uint32_t root = 0;
+        uint32_t info = 0;
+        vector<uint32_t> pages;  // Leaf pages in document order
+        set<uint32_t> tree;      // Catalog and page tree nodes; replaced by the merged ones
+        set<uint32_t> visited;
+        map<uint32_t, uint32_t> renumbered;
+    };
+
+    bool is_white(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+    }
+
+    bool is_delimiter(char c)
+    {
+        return strchr("()<>[]{}/%", c) != nullptr;
+    }
+
+    bool is_regular(char c)
+    {
+        return !is_white(c) && !is_delimiter(c);
+    }
+
+    string read_file(const string &path)
+    {
+        ifstream file(path, ios::binary);
+        if (!file.is_open())
+        {
+            throw runtime_error("Could not open PDF file: " + path);
+        }
+        ostringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    [[noreturn]] void unsupported(const SourceFile &file, const string &what)
+    {
+        throw runtime_error("Cannot merge " + file.path + ": " + what);
+    }
+
+    // Minimal cursor over PDF syntax
+    struct Cursor
+    {
+        string_view text;
+        size_t pos = 0;
+
+        void skipWhite()
+        {
+            while (pos < text.size())
+            {
+                if (is_white(text[pos]))
+                {
+                    ++pos;
+                }
+                else if (text[pos] == '%')
+                {
+                    while (pos < text.size() && text[pos] != '\n' && text[pos] != '\r')
+                    {
+                        ++pos;
+                    }
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+
+        bool readUint(uint64_t &value)
+        {
+            skipWhite();
+            size_t start = pos;
+            value = 0;
+            while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
+            {
+                value = value * 10 + (text[pos++] - '0');
+            }
+            return pos > start && (pos == text.size() || !is_regular(text[pos]));
+        }
+
+        bool keyword(const char *word)
+        {
+            skipWhite();
+            size_t length = strlen(word);
+            if (text.compare(pos, length, word) != 0 || (pos + length < text.size() && is_regular(text[pos + length])))
+            {
+                return false;
+            }
+            pos += length;
+            return true;
+        }
+
+        // "id gen R"
+        bool readRef(uint32_t &id)
+        {
+            size_t start = pos;
+            uint64_t object, generation;
+            if (readUint(object) && readUint(generation) && keyword("R"))
+            {
+                id = static_cast<uint32_t>(object);
+                return true;
+            }
+            pos = start;
+            return false;
+        }
+    };
+
+    // Position just after the value key in a dictionary's text, or npos.
+    // Names are matched as whole tokens, so "/Pages" does not match "/PageMode".
+    size_t find_key(string_view dict, const char *key)
+    {
+        size_t length = strlen(key);
+        for (size_t pos = dict.find(key); pos != string_view::npos; pos = dict.find(key, pos + 1))
+        {
+            size_t end = pos + length;
+            if (end == dict.size() || !is_regular(dict[end]))
+            {
+                return end;
+            }
+        }
+        return string_view::npos;
+    }
+
+    bool dict_ref(string_view dict, const char *key, uint32_t &id)
+    {
+        size_t pos = find_key(dict, key);
+        if (pos == string_view::npos)
+        {
+            return false;
+        }
+        Cursor cursor{dict, pos};
+        return cursor.readRef(id);
+    }
+
+    string dict_name(string_view dict, const char *key)
+    {
+        size_t pos = find_key(dict, key);
+        if (pos == string_view::npos)
+        {
+            return string();
+        }
+        Cursor cursor{dict, pos};
+        cursor.skipWhite();
+        size_t start = cursor.pos;
+        if (start >= dict.size() || dict[start] != '/')
+        {
+            return string();
+        }
+        size_t end = start + 1;
+        while (end < dict.size() && is_regular(dict[end]))
+        {
+            ++end;
+        }
+        return string(dict.substr(start + 1, end - start - 1));
+    }
+
+    // Byte range of an object's body: after "id gen obj", before "endobj"
+    string_view object_body(const SourceFile &file, const string &data, uint32_t id)
+    {
+        auto it = file.offsets.find(id);
+        if (it == file.offsets.end())
+        {
+            unsupported(file, "missing object " + to_string(id));
+        }
+        // Objects run up to the next one in the file (or the xref table), so
+        // stream data is never scanned for keywords
+        size_t end = *upper_bound(file.boundaries.begin(), file.boundaries.end(), it->second);
+
+        Cursor cursor{string_view(data).substr(0, end), it->second};
+        uint64_t object, generation;
+        if (!cursor.readUint(object) || object != id || !cursor.readUint(generation) || !cursor.keyword("obj"))
+        {
+            unsupported(file, "bad xref entry for object " + to_string(id));
+        }
+        size_t body_end = string_view(data).substr(0, end).rfind("endobj");
+        if (body_end == string_view::npos || body_end < cursor.pos)
+        {
+            unsupported(file, "unterminated object " + to_string(id));
+        }
+        return string_view(data).substr(cursor.pos, body_end - cursor.pos);
+    }
+
+    void read_xref(SourceFile &file, const string &data)
+    {
+        size_t startxref = data.rfind("startxref");
+        if (startxref == string::npos)
+        {
+            unsupported(file, "no startxref");
+        }
+        Cursor cursor{data, startxref + strlen("startxref")};
+        uint64_t offset;
+        if (!cursor.readUint(offset) || offset >= data.size())
+        {
+            unsupported(file, "bad startxref");
+        }
+        file.xref_offset = offset;
+
+        cursor.pos = offset;
+        if (!cursor.keyword("xref"))
+        {
+            unsupported(file, "cross-reference streams are not supported");
+        }
+        while (!cursor.keyword("trailer"))
+        {
+            uint64_t first, count;
+            if (!cursor.readUint(first) || !cursor.readUint(count))
+            {
+                unsupported(file, "bad xref section");
+            }
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                uint64_t entry_offset, generation;
+                if (!cursor.readUint(entry_offset) || !cursor.readUint(generation))
+                {
+                    unsupported(file, "bad xref entry");
+                }
+                if (cursor.keyword("n"))
+                {
+                    file.offsets[static_cast<uint32_t>(first + i)] = entry_offset;
+                }
+                else if (!cursor.keyword("f"))
+                {
+                    unsupported(file, "bad xref entry");
+                }
+            }
+        }
+
+        string_view trailer = string_view(data).substr(cursor.pos, startxref - cursor.pos);
+        if (find_key(trailer, "/Prev") != string_view::npos || find_key(trailer, "/Encrypt") != string_view::npos)
+        {
+            unsupported(file, "incremental updates and encryption are not supported");
+        }
+        if (!dict_ref(trailer, "/Root", file.root))
+        {
+            unsupported(file, "no document catalog");
+        }
+        dict_ref(trailer, "/Info", file.info);
+
+        for (const auto &entry : file.offsets)
+        {
+            if (entry.second >= file.xref_offset)
+            {
+                unsupported(file, "object after the xref table");
+            }
+            file.boundaries.push_back(entry.second);
+        }
+        file.boundaries.push_back(file.xref_offset);
+        sort(file.boundaries.begin(), file.boundaries.end());
+    }
+
+    void collect_pages(SourceFile &file, const string &data, uint32_t node, int depth)
+    {
+        if (depth > 64 || !file.visited.insert(node).second)
+        {
+            unsupported(file, "page tree has a cycle");
+        }
+        string_view dict = object_body(file, data, node);
+        string type = dict_name(dict, "/Type");
+        if (type == "Page")
+        {
+            file.pages.push_back(node);
+            return;
+        }
+        if (type != "Pages")
+        {
+            unsupported(file, "unexpected page tree node " + to_string(node));
+        }
+        file.tree.insert(node);
+        for (const char *inherited : {"/Resources", "/MediaBox", "/CropBox", "/Rotate"})
+        {
+            if (find_key(dict, inherited) != string_view::npos)
+            {
+                unsupported(file, "inherited page attributes are not supported");
+            }
+        }
+
+        size_t kids = find_key(dict, "/Kids");
+        Cursor cursor{dict, kids};
+        if (kids == string_view::npos || !cursor.keyword("["))
+        {
+            unsupported(file, "page tree node without /Kids");
+        }
+        uint32_t kid;
+        while (cursor.readRef(kid))
+        {
+            collect_pages(file, data, kid, depth + 1);
+        }
+        if (!cursor.keyword("]"))
+        {
+            unsupported(file, "bad /Kids array");
+        }
+    }
+
+    // Copies object text with every "id gen R" renumbered. Strings, names and
+    // comments are copied untouched; copying stops at a "stream" keyword,
+    // whose data the caller copies verbatim.
+    size_t rewrite_refs(const SourceFile &file, string_view body, string &out)
+    {
+        size_t pos = 0;
+        while (pos < body.size())
+        {
+            char c = body[pos];
+            if (c == '(')
+            {
+                int depth = 0;
+                size_t start = pos;
+                for (; pos < body.size(); ++pos)
+                {
+                    if (body[pos] == '\\')
+                    {
+                        ++pos;
+                    }
+                    else if (body[pos] == '(')
+                    {
+                        ++depth;
+                    }
+                    else if (body[pos] == ')' && --depth == 0)
+                    {
+                        ++pos;
+                        break;
+                    }
+                }
+                out.append(body.substr(start, pos - start));
+            }
+            else if (c == '<' && pos + 1 < body.size() && body[pos + 1] == '<')
+            {
+                out += "<<";
+                pos += 2;
+            }
+            else if (c == '<')
+            {
+                size_t end = body.find('>', pos);
+                end = end == string_view::npos ? body.size() : end + 1;
+                out.append(body.substr(pos, end - pos));
+                pos = end;
+            }
+            else if (c == '%' || c == '/')
+            {
+                size_t end = pos + 1;
+                while (end < body.size() && (c == '%' ? body[end] != '\n' && body[end] != '\r' : is_regular(body[end])))
+                {
+                    ++end;
+                }
+                out.append(body.substr(pos, end - pos));
+                pos = end;
+            }
+            else if (c >= '0' && c <= '9')
+            {
+                Cursor cursor{body, pos};
+                uint32_t id;
+                if (cursor.readRef(id))
+                {
+                    auto it = file.renumbered.find(id);
+                    if (it == file.renumbered.end())
+                    {
+                        unsupported(file, "reference to missing object " + to_string(id));
+                    }
+                    out += to_string(it->second);
+                    out += " 0 R";
+                    pos = cursor.pos;
+                }
+                else
+                {
+                    size_t end = pos;
+                    while (end < body.size() && is_regular(body[end]))
+                    {
+                        ++end;
+                    }
+                    out.append(body.substr(pos, end - pos));
+                    pos = end;
+                }
+            }
+            else if (is_regular(c))
+            {
+                size_t end = pos;
+                while (end < body.size() && is_regular(body[end]))
+                {
+                    ++end;
+                }
+                if (body.substr(pos, end - pos) == "stream")
+                {
+                    return pos;
+                }
+                out.append(body.substr(pos, end - pos));
+                pos = end;
+            }
+            else
+            {
+                out += c;
+                ++pos;
+            }
+        }
+        return pos;
+    }
+
+    // Tracks byte offsets for the xref table while writing. Buffered, so a
+    // pipe or socket gets large writes; throws runtime_error if one fails.
+    struct Output
+    {
+        int fd = -1;
+        string buffer;
+        size_t written = 0;
+        vector<size_t> offsets; // Index = object id
+
+        void write(string_view text)
+        {
+            buffer.append(text.data(), text.size());
+            written += text.size();
+            if (buffer.size() >= 256 * 1024)
+            {
+                flush();
+            }
+        }
+
+        void flush()
+        {
+            size_t done = 0;
+            while (done < buffer.size())
+            {
+                ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw runtime_error(string("Failed to write PDF: ") + strerror(errno));
+                }
+                done += n;
+            }
+            buffer.clear();
+        }
+
+        void beginObject(uint32_t id)
+        {
+            if (offsets.size() <= id)
+            {
+                offsets.resize(id + 1, 0);
+            }
+            offsets[id] = written;
+            write(to_string(id) + " 0 obj");
+        }
+    };
+}
+
+void mergePdfFiles(const vector<string> &inputs, const string &output)
+{
+    int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        throw runtime_error("Could not create PDF file: " + output);
+    }
+    try
+    {
+        mergePdfFiles(inputs, fd);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0)
+    {
+        throw runtime_error("Failed to write PDF file: " + output);
+    }
+}
+
+void mergePdfFiles(const vector<string> &inputs, int fd)
+{
+    const uint32_t CATALOG_ID = 1;
+    const uint32_t PAGES_ID = 2;
+
+    // First pass: cross-reference tables and page order, one file at a time
+    vector<SourceFile> files(inputs.size());
+    string version = "%PDF-1.3";
+    uint32_t next_id = PAGES_ID + 1;
+    size_t page_count = 0;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        SourceFile &file = files[i];
+        file.path = inputs[i];
+        string data = read_file(file.path);
+        if (data.compare(0, 5, "%PDF-") != 0)
+        {
+            unsupported(file, "not a PDF file");
+        }
+        if (i == 0)
+        {
+            version = data.substr(0, data.find_first_of("\r\n"));
+        }
+        read_xref(file, data);
+
+        uint32_t pages_root;
+        if (!dict_ref(object_body(file, data, file.root), "/Pages", pages_root))
+        {
+            unsupported(file, "catalog without /Pages");
+        }
+        file.tree.insert(file.root);
+        collect_pages(file, data, pages_root, 0);
+        page_count += file.pages.size();
+
+        // Every other object keeps its place in order, under a new number
+        for (const auto &entry : file.offsets)
+        {
+            uint32_t id = entry.first;
+            if (file.tree.count(id))
+            {
+                file.renumbered[id] = id == file.root ? CATALOG_ID : PAGES_ID;
+            }
+            else if (i > 0 && id == file.info)
+            {
+                continue; // Only the first document's Info is kept
+            }
+            else
+            {
+                file.renumbered[id] = next_id++;
+            }
+        }
+    }
+
+    Output out;
+    out.fd = fd;
+    out.write(version + "\n%\xB7\xBE\xAD\xAA\n");
+
+    out.beginObject(CATALOG_ID);
+    out.write("\n<<\n/Type /Catalog\n/Pages " + to_string(PAGES_ID) + " 0 R\n>>\nendobj\n");
+
+    out.beginObject(PAGES_ID);
+    out.write("\n<<\n/Type /Pages\n/Kids [ ");
+    for (const auto &file : files)
+    {
+        for (uint32_t page : file.pages)
+        {
+            out.write(to_string(file.renumbered.at(page)) + " 0 R ");
+        }
+    }
+    out.write("]\n/Count " + to_string(page_count) + "\n>>\nendobj\n");
+
+    // Second pass: copy objects with renumbered references
+    string text;
+    for (const auto &file : files)
+    {
+        string data = read_file(file.path);
+        for (const auto &entry : file.offsets)
+        {
+            uint32_t id = entry.first;
+            auto mapped = file.renumbered.find(id);
+            if (mapped == file.renumbered.end() || file.tree.count(id))
+            {
+                continue;
+            }
+            string_view body = object_body(file, data, id);
+            text.clear();
+            size_t stream = rewrite_refs(file, body, text);
+            out.beginObject(mapped->second);
+            out.write(text);
+            out.write(body.substr(stream));
+            out.write("endobj\n");
+        }
+    }
+
+    size_t xref_offset = out.written;
+    uint32_t info = files.empty() ? 0 : (files[0].info ? files[0].renumbered.at(files[0].info) : 0);
+    out.offsets.resize(next_id, 0);
+    out.write("xref\n0 " + to_string(next_id) + "\n0000000000 65535 f\r\n");
+    char entry[32];
+    for (uint32_t id = 1; id < next_id; ++id)
+    {
+        snprintf(entry, sizeof(entry), "%010zu 00000 n\r\n", out.offsets[id]);
+        out.write(entry);
+    }
+    out.write("trailer\n<<\n/Root " + to_string(CATALOG_ID) + " 0 R\n");
+    if (info)
+    {
+        out.write("/Info " + to_string(info) + " 0 R\n");
+    }
+    out.write("/Size " + to_string(next_id) + "\n>>\nstartxref\n" + to_string(xref_offset) + "\n%%EOF\n");
+
+    out.flush();
+}
@@ -0,0 +1,17 @@
+#ifndef PDF_MERGE_H
+#define PDF_MERGE_H
+
+#include <string>
+#include <vector>
+
+// Concatenates the pages of several PDFs into one file, in order. Written for
+// the documents libharu produces (one classic xref table, a page tree without
+// inherited attributes, no encryption); every object is copied as is apart
+// from renumbering its references, and stream data is never decoded. Only one
+// input is held in memory at a time. Throws runtime_error for anything else.
+void mergePdfFiles(const std::vector<std::string> &inputs, const std::string &output);
+
+// Same, written to fd (a file, pipe or socket), which is left open
+void mergePdfFiles(const std::vector<std::string> &inputs, int fd);
+
+#endif
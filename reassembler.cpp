@@ -0,0 +1,152 @@
+#include "reassembler.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+
+using namespace std;
+
+static const char FRAGMENT_MAGIC[4] = {'U', 'F', 'R', 'G'};
+
+bool FragmentHeader::parse(const char *data, size_t length, FragmentHeader &header)
+{
+    if (length < SIZE || memcmp(data, FRAGMENT_MAGIC, sizeof(FRAGMENT_MAGIC)) != 0)
+    {
+        return false;
+    }
+    uint32_t id;
+    uint16_t index, count;
+    memcpy(&id, data + 4, sizeof(id));
+    memcpy(&index, data + 8, sizeof(index));
+    memcpy(&count, data + 10, sizeof(count));
+    header.message_id = ntohl(id);
+    header.index = ntohs(index);
+    header.count = ntohs(count);
+    return header.count > 0 && header.index < header.count;
+}
+
+void FragmentHeader::write(char *out, uint32_t message_id, uint16_t index, uint16_t count)
+{
+    uint32_t id = htonl(message_id);
+    uint16_t i = htons(index), c = htons(count);
+    memcpy(out, FRAGMENT_MAGIC, sizeof(FRAGMENT_MAGIC));
+    memcpy(out + 4, &id, sizeof(id));
+    memcpy(out + 8, &i, sizeof(i));
+    memcpy(out + 10, &c, sizeof(c));
+}
+
+// Memory held besides the payload: a message's map and list nodes, and each
+// piece's map node (roughly, allocator headers aside)
+const size_t Reassembler::PARTIAL_OVERHEAD = sizeof(Partial) + 2 * sizeof(Key) + 6 * sizeof(void *);
+const size_t Reassembler::PIECE_OVERHEAD = sizeof(uint16_t) + sizeof(string) + 4 * sizeof(void *);
+
+Reassembler::Reassembler(const ReassemblyOptions &options)
+    : options(options), pending_bytes(0)
+{
+}
+
+bool Reassembler::add(const sockaddr_in &sender, const FragmentHeader &header, const char *payload, size_t length,
+                      string &message)
+{
+    stats.fragments++;
+
+    // A single-fragment message needs no state at all
+    if (header.count == 1)
+    {
+        if (length > options.max_message_bytes)
+        {
+            stats.invalid++;
+            return false;
+        }
+        message.assign(payload, length);
+        stats.reassembled++;
+        return true;
+    }
+
+    // Every piece of a longer message carries at least one byte, so no
+    // message within the size limit has more pieces than it has bytes
+    if (length == 0 || header.count > options.max_message_bytes)
+    {
+        stats.invalid++;
+        return false;
+    }
+
+    Key key((static_cast<uint64_t>(sender.sin_addr.s_addr) << 16) | sender.sin_port, header.message_id);
+    auto it = partials.find(key);
+    if (it == partials.end())
+    {
+        it = partials.emplace(key, Partial()).first;
+        Partial &partial = it->second;
+        partial.count = header.count;
+        partial.started = chrono::steady_clock::now();
+        partial.arrival = arrivals.insert(arrivals.end(), key);
+        partial.charged = PARTIAL_OVERHEAD;
+        pending_bytes += PARTIAL_OVERHEAD;
+    }
+
+    Partial &partial = it->second;
+    if (partial.pieces.count(header.index) != 0 && partial.count == header.count)
+    {
+        // UDP may deliver a datagram twice; the first copy stands
+        stats.duplicates++;
+        return false;
+    }
+    if (partial.count != header.count || partial.bytes + length > options.max_message_bytes)
+    {
+        stats.invalid++;
+        drop(it);
+        return false;
+    }
+
+    partial.pieces[header.index].assign(payload, length);
+    partial.bytes += length;
+    partial.charged += PIECE_OVERHEAD + length;
+    pending_bytes += PIECE_OVERHEAD + length;
+
+    if (partial.pieces.size() == header.count)
+    {
+        message.clear();
+        message.reserve(partial.bytes);
+        for (const auto &piece : partial.pieces)
+        {
+            message += piece.second;
+        }
+        drop(it);
+        stats.reassembled++;
+        return true;
+    }
+
+    while (pending_bytes > options.max_pending_bytes && !partials.empty())
+    {
+        evictOldest();
+    }
+    return false;
+}
+
+// Partials start in arrival order, so the expired ones are at the front
+void Reassembler::expire()
+{
+    auto deadline = chrono::steady_clock::now() - chrono::milliseconds(options.timeout_ms);
+    while (!arrivals.empty())
+    {
+        auto it = partials.find(arrivals.front());
+        if (it->second.started >= deadline)
+        {
+            break;
+        }
+        stats.timeouts++;
+        drop(it);
+    }
+}
+
+void Reassembler::drop(map<Key, Partial>::iterator it)
+{
+    pending_bytes -= it->second.charged;
+    arrivals.erase(it->second.arrival);
+    partials.erase(it);
+}
+
+void Reassembler::evictOldest()
+{
+    stats.evicted++;
+    drop(partials.find(arrivals.front()));
+}
@@ -0,0 +1,100 @@
+#ifndef REASSEMBLER_H
+#define REASSEMBLER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <netinet/in.h>
+
+// Optional fragment header for records larger than one datagram. All fields
+// are big-endian:
+//
+//   0  "UFRG"        magic
+//   4  message_id    uint32, chosen by the sender, unique per sender address
+//   8  index         uint16, 0-based
+//   10 count         uint16, total fragments in the message (>= 1)
+//   12 payload...
+//
+// Datagrams without the magic are treated as a complete record.
+struct FragmentHeader
+{
+    static const size_t SIZE = 12;
+
+    uint32_t message_id;
+    uint16_t index;
+    uint16_t count;
+
+    // Returns false if data does not start with a well-formed header
+    static bool parse(const char *data, size_t length, FragmentHeader &header);
+    static void write(char *out, uint32_t message_id, uint16_t index, uint16_t count);
+};
+
+struct ReassemblyOptions
+{
+    size_t max_message_bytes = 1024 * 1024;      // Largest record we are willing to rebuild
+    size_t max_pending_bytes = 16 * 1024 * 1024; // All partial messages together
+    int timeout_ms = 2000;                       // Give up on a message after this long
+};
+
+struct ReassemblyCounters
+{
+    uint64_t fragments = 0;   // Fragment datagrams seen
+    uint64_t reassembled = 0; // Messages completed
+    uint64_t timeouts = 0;    // Messages dropped because fragments stopped arriving
+    uint64_t evicted = 0;     // Messages dropped to stay under max_pending_bytes
+    uint64_t invalid = 0;     // Inconsistent or impossible counts, empty pieces, oversize messages
+    uint64_t duplicates = 0;  // Pieces received again; ignored
+};
+
+// Rebuilds fragmented records, with bounded memory and a per-message timeout.
+// Pieces are only stored as they arrive, and every partial message is
+// charged its bookkeeping as well as its payload against max_pending_bytes,
+// so tiny fragments announcing many pieces cannot pile up unbounded. Partials are kept in
+// arrival order, so evicting or expiring the oldest needs no scan.
+// Used by one parse thread only; not thread-safe.
+class Reassembler
+{
+public:
+    explicit Reassembler(const ReassemblyOptions &options);
+
+    // Feeds one fragment payload (header already parsed). Returns true and
+    // fills message when this fragment completes it.
+    bool add(const sockaddr_in &sender, const FragmentHeader &header, const char *payload, size_t length,
+             std::string &message);
+
+    // Drops messages older than the timeout; call periodically
+    void expire();
+
+    const ReassemblyCounters &counters() const { return stats; }
+    size_t pendingBytes() const { return pending_bytes; }
+
+private:
+    using Key = std::pair<uint64_t, uint32_t>; // (sender address:port, message id)
+
+    struct Partial
+    {
+        std::map<uint16_t, std::string> pieces; // By index
+        uint16_t count = 0;
+        size_t bytes = 0;   // Payload so far
+        size_t charged = 0; // Payload plus bookkeeping, counted in pending_bytes
+        std::chrono::steady_clock::time_point started;
+        std::list<Key>::iterator arrival;
+    };
+
+    ReassemblyOptions options;
+    std::map<Key, Partial> partials;
+    std::list<Key> arrivals; // Keys of partials, oldest first
+    size_t pending_bytes;
+    ReassemblyCounters stats;
+
+    static const size_t PARTIAL_OVERHEAD; // Bookkeeping charged per message
+    static const size_t PIECE_OVERHEAD;   // And per piece
+    void drop(std::map<Key, Partial>::iterator it);
+    void evictOldest();
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "receive_engine.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+ReceiveEngine::ReceiveEngine(int sockfd, BufferPool &pool, DatagramHandler handler)
+    : sockfd(sockfd), epoll_fd(-1), stop_fd(-1), pool(pool), handler(move(handler)), pool_drops(0),
+      kernel_drops(0), last_overflow(0),
+      discard(pool.bufferSize()), slot_buffers(BATCH_SIZE, nullptr), messages(BATCH_SIZE), iovecs(BATCH_SIZE),
+      addresses(BATCH_SIZE), controls(BATCH_SIZE * CONTROL_SIZE)
+{
+    // Wire every message slot to its iovec and address once, up front; the
+    // buffers behind the iovecs come from the pool before each recvmmsg
+    for (size_t i = 0; i < BATCH_SIZE; ++i)
+    {
+        iovecs[i].iov_len = pool.bufferSize();
+
+        memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &addresses[i];
+    }
+}
+
+ReceiveEngine::~ReceiveEngine()
+{
+    // Buffers still parked in message slots go back to the pool
+    for (char *buffer : slot_buffers)
+    {
+        if (buffer != nullptr)
+        {
+            pool.release(buffer);
+        }
+    }
+    if (stop_fd != -1)
+    {
+        close(stop_fd);
+    }
+    if (epoll_fd != -1)
+    {
+        close(epoll_fd);
+    }
+}
+
+bool ReceiveEngine::init()
+{
+    int on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+    {
+        // Not fatal: arrival is then timed in user space, once per batch
+        cerr << "Failed to enable receive timestamps: " << strerror(errno) << endl;
+    }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1)
+    {
+        cerr << "Failed to enable receive queue drop counts: " << strerror(errno) << endl;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        cerr << "Failed to create epoll instance: " << strerror(errno) << endl;
+        return false;
+    }
+
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd == -1)
+    {
+        cerr << "Failed to create eventfd: " << strerror(errno) << endl;
+        return false;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+
+    ev.data.fd = sockfd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &ev) == -1)
+    {
+        cerr << "Failed to add socket to epoll: " << strerror(errno) << endl;
+        return false;
+    }
+
+    ev.data.fd = stop_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev) == -1)
+    {
+        cerr << "Failed to add eventfd to epoll: " << strerror(errno) << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void ReceiveEngine::run()
+{
+    epoll_event events[4];
+
+    while (true)
+    {
+        int ready = epoll_wait(epoll_fd, events, 4, -1);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "epoll_wait failed: " << strerror(errno) << endl;
+            return;
+        }
+
+        for (int i = 0; i < ready; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == sockfd)
+            {
+                drainSocket();
+            }
+            else if (fd == stop_fd)
+            {
+                uint64_t value;
+                if (read(stop_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                {
+                    cerr << "Failed to read eventfd: " << strerror(errno) << endl;
+                }
+                return;
+            }
+        }
+    }
+}
+
+void ReceiveEngine::stop()
+{
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0)
+    {
+        cerr << "Failed to signal eventfd: " << strerror(errno) << endl;
+    }
+}
+
+void ReceiveEngine::drainSocket()
+{
+    while (true)
+    {
+        for (size_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            // Slots handed downstream last time need a fresh buffer
+            if (slot_buffers[i] == nullptr)
+            {
+                slot_buffers[i] = pool.acquire();
+            }
+            iovecs[i].iov_base = slot_buffers[i] != nullptr ? slot_buffers[i] : discard.data();
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[i].msg_hdr.msg_control = &controls[i * CONTROL_SIZE];
+            messages[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+            messages[i].msg_hdr.msg_flags = 0;
+        }
+
+        int n = recvmmsg(sockfd, messages.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if (n == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                cerr << "Error receiving data: " << strerror(errno) << endl;
+            }
+            return;
+        }
+
+        uint64_t batch_time = 0; // Fallback when the kernel gave no timestamp
+        for (int i = 0; i < n; ++i)
+        {
+            uint64_t received_ns = 0;
+            msghdr &header = messages[i].msg_hdr;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                {
+                    timespec ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    received_ns = uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+                }
+                else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                {
+                    // Only sent once the count is non-zero; it may wrap
+                    uint32_t overflow;
+                    memcpy(&overflow, CMSG_DATA(cmsg), sizeof(overflow));
+                    if (overflow != last_overflow)
+                    {
+                        kernel_drops.fetch_add(uint32_t(overflow - last_overflow), memory_order_relaxed);
+                        last_overflow = overflow;
+                    }
+                }
+            }
+
+            if (slot_buffers[i] == nullptr)
+            {
+                // Landed in the discard buffer: downstream is holding every buffer
+                pool_drops.fetch_add(1, memory_order_relaxed);
+                continue;
+            }
+            if (received_ns == 0)
+            {
+                if (batch_time == 0)
+                {
+                    timespec now;
+                    clock_gettime(CLOCK_REALTIME, &now);
+                    batch_time = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+                }
+                received_ns = batch_time;
+            }
+
+            bool truncated = (header.msg_flags & MSG_TRUNC) != 0;
+            handler(slot_buffers[i], messages[i].msg_len, addresses[i], truncated, received_ns);
+            slot_buffers[i] = nullptr;
+        }
+
+        // A short batch means the queue is empty; epoll will wake us for the next one
+        if (static_cast<size_t>(n) < BATCH_SIZE)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef RECEIVE_ENGINE_H
+#define RECEIVE_ENGINE_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "buffer_pool.h"
+
+// Event-driven UDP receive loop. Blocks in epoll until the socket is readable,
+// then drains it with recvmmsg, BATCH_SIZE datagrams per syscall, straight
+// into buffers taken from a BufferPool. Each datagram comes with the kernel's
+// receive timestamp (SO_TIMESTAMPNS), and the kernel's count of datagrams it
+// dropped on a full receive queue (SO_RXQ_OVFL) is tracked. Shutdown is requested through an
+// eventfd (stop()).
+class ReceiveEngine
+{
+public:
+    static const size_t BATCH_SIZE = 64;
+
+    // Receives ownership of buffer and must return it to the pool eventually.
+    // truncated is set when the datagram was larger than the buffer;
+    // received_ns is the arrival time in nanoseconds since the epoch.
+    using DatagramHandler = std::function<void(char *buffer, size_t length, const sockaddr_in &sender, bool truncated,
+                                               uint64_t received_ns)>;
+
+    ReceiveEngine(int sockfd, BufferPool &pool, DatagramHandler handler);
+    ~ReceiveEngine();
+
+    ReceiveEngine(const ReceiveEngine &) = delete;
+    ReceiveEngine &operator=(const ReceiveEngine &) = delete;
+
+    // Enables receive timestamps and drop counts and creates the epoll instance and the stop
+    // eventfd. Returns false on failure.
+    bool init();
+
+    // Runs until stop() is called.
+    void run();
+
+    // Safe to call from any thread.
+    void stop();
+
+    // Datagrams discarded because every pool buffer was still in flight
+    uint64_t poolDrops() const { return pool_drops.load(std::memory_order_relaxed); }
+
+    // Datagrams the kernel dropped because the socket's receive queue was
+    // full, as of the last datagram received
+    uint64_t kernelDrops() const { return kernel_drops.load(std::memory_order_relaxed); }
+
+private:
+    int sockfd;
+    int epoll_fd;
+    int stop_fd;
+    BufferPool &pool;
+    DatagramHandler handler;
+    std::atomic<uint64_t> pool_drops;
+    std::atomic<uint64_t> kernel_drops;
+    uint32_t last_overflow; // Kernel's 32-bit running count, to take deltas from
+
+    std::vector<char> discard; // Receives into here when the pool is empty
+    std::vector<char *> slot_buffers;
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iovecs;
+    std::vector<sockaddr_in> addresses;
+    std::vector<char> controls; // Room for a timestamp and a drop count per slot
+
+    void drainSocket();
+};
+
+#endif
@@ -0,0 +1,853 @@
+#include "record.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <arpa/inet.h>
+#include "string_interner.h"
+
+using json = nlohmann::json;
+using namespace std;
+
+const char *const Record::FIELD_NAMES[Record::FIELD_COUNT] = {"cmd_name", "data", "range", "status", "input_other", "output_other"};
+
+// Receive metadata members; RecordParser::parseKey numbers them after the fields
+static const char *const RECEIVED_KEY = "_received_ns";
+static const char *const SENDER_KEY = "_sender";
+static const int RECEIVED_INDEX = Record::FIELD_COUNT;
+static const int SENDER_INDEX = Record::FIELD_COUNT + 1;
+
+// "a.b.c.d:port"
+static bool parse_sender(string_view text, uint32_t &ip, uint16_t &port)
+{
+    size_t colon = text.rfind(':');
+    if (colon == string_view::npos || colon > 15 || colon + 1 == text.size() || text.size() - colon > 6)
+    {
+        return false;
+    }
+    char address[16];
+    memcpy(address, text.data(), colon);
+    address[colon] = '\0';
+    in_addr parsed;
+    if (inet_pton(AF_INET, address, &parsed) != 1)
+    {
+        return false;
+    }
+    uint32_t value = 0;
+    for (size_t i = colon + 1; i < text.size(); ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    if (value > 0xFFFF)
+    {
+        return false;
+    }
+    ip = parsed.s_addr;
+    port = static_cast<uint16_t>(value);
+    return true;
+}
+
+string Record::senderText() const
+{
+    char address[INET_ADDRSTRLEN];
+    in_addr addr;
+    addr.s_addr = sender_ip;
+    inet_ntop(AF_INET, &addr, address, sizeof(address));
+    return string(address) + ":" + to_string(sender_port);
+}
+
+bool RecordFilter::matches(const Record &record) const
+{
+    if (timeBounded() && (record.received_ns == 0 || record.received_ns < received_from_ns || record.received_ns > received_to_ns))
+    {
+        return false;
+    }
+    auto any_of_strings = [](const vector<string> &wanted, const RecordField &field)
+    {
+        return wanted.empty() ||
+               (field.kind == FieldKind::String && find(wanted.begin(), wanted.end(), field.str()) != wanted.end());
+    };
+    return any_of_strings(statuses, record.fields[Record::STATUS]) && any_of_strings(cmd_names, record.fields[Record::CMD_NAME]);
+}
+
+Arena::Arena(size_t block_size)
+    : block_size(block_size), current(0), used(0)
+{
+}
+
+char *Arena::allocate(size_t size, size_t align)
+{
+    if (!blocks.empty())
+    {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (offset + size <= blocks[current].size)
+        {
+            used = offset + size;
+            return blocks[current].data.get() + offset;
+        }
+    }
+
+    // Move to the next block, reusing one left over from a rewind if it is big enough
+    size_t next = blocks.empty() ? 0 : current + 1;
+    if (next >= blocks.size() || blocks[next].size < size)
+    {
+        Block block;
+        block.size = max(block_size, size);
+        block.data.reset(new char[block.size]);
+        blocks.insert(blocks.begin() + next, move(block));
+    }
+    current = next;
+    used = size;
+    // Blocks come from new[], which is aligned for any fundamental type
+    return blocks[current].data.get();
+}
+
+string_view Arena::copy(const char *data, size_t size)
+{
+    if (size == 0)
+    {
+        return string_view();
+    }
+    char *dest = allocate(size);
+    memcpy(dest, data, size);
+    return string_view(dest, size);
+}
+
+void Arena::rewind(const Mark &m)
+{
+    current = m.block;
+    used = m.used;
+}
+
+size_t Arena::bytesUsed() const
+{
+    size_t total = used;
+    for (size_t i = 0; i < current && i < blocks.size(); ++i)
+    {
+        total += blocks[i].size;
+    }
+    return total;
+}
+
+size_t Arena::bytesReserved() const
+{
+    size_t total = 0;
+    for (const auto &block : blocks)
+    {
+        total += block.size;
+    }
+    return total;
+}
+
+json Record::toJson() const
+{
+    json value = extra.empty() ? json::object() : json::parse(extra);
+    for (size_t i = 0; i < FIELD_COUNT; ++i)
+    {
+        const RecordField &field = fields[i];
+        if (field.kind == FieldKind::String)
+        {
+            value[FIELD_NAMES[i]] = string(field.str());
+        }
+        else if (field.kind == FieldKind::List)
+        {
+            json items = json::array();
+            for (const auto &item : field)
+            {
+                items.push_back(string(item));
+            }
+            value[FIELD_NAMES[i]] = move(items);
+        }
+    }
+    if (received_ns != 0)
+    {
+        value[RECEIVED_KEY] = received_ns;
+    }
+    if (sender_ip != 0 || sender_port != 0)
+    {
+        value[SENDER_KEY] = senderText();
+    }
+    return value;
+}
+
+static void append_json_string(string &out, string_view text)
+{
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (char ch : text)
+    {
+        unsigned char c = static_cast<unsigned char>(ch);
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+            }
+            else
+            {
+                out += ch;
+            }
+        }
+    }
+    out += '"';
+}
+
+void Record::appendJson(string &out) const
+{
+    out += '{';
+    bool first = true;
+    for (size_t i = 0; i < FIELD_COUNT; ++i)
+    {
+        const RecordField &field = fields[i];
+        if (field.kind == FieldKind::Missing)
+        {
+            continue;
+        }
+        if (!first)
+        {
+            out += ',';
+        }
+        first = false;
+
+        out += '"';
+        out += FIELD_NAMES[i];
+        out += "\":";
+        if (field.kind == FieldKind::String)
+        {
+            append_json_string(out, field.str());
+        }
+        else
+        {
+            out += '[';
+            for (size_t j = 0; j < field.size(); ++j)
+            {
+                if (j > 0)
+                {
+                    out += ',';
+                }
+                append_json_string(out, field.begin()[j]);
+            }
+            out += ']';
+        }
+    }
+
+    if (received_ns != 0)
+    {
+        out += first ? "\"" : ",\"";
+        out += RECEIVED_KEY;
+        out += "\":";
+        out += to_string(received_ns);
+        first = false;
+    }
+    if (sender_ip != 0 || sender_port != 0)
+    {
+        out += first ? "\"" : ",\"";
+        out += SENDER_KEY;
+        out += "\":";
+        append_json_string(out, senderText());
+        first = false;
+    }
+
+    // extra is itself a compact object; splice its members in
+    if (extra.size() > 2)
+    {
+        if (!first)
+        {
+            out += ',';
+        }
+        out.append(extra.data() + 1, extra.size() - 2);
+    }
+    out += '}';
+}
+
+// Interned when an interner is given and has room, copied otherwise
+static string_view store_value(const string &text, Arena &arena, StringInterner *interner)
+{
+    string_view canonical;
+    if (interner != nullptr && interner->intern(text, canonical) != StringInterner::NONE)
+    {
+        return canonical;
+    }
+    return arena.copy(text);
+}
+
+bool Record::fromJson(const json &value, Arena &arena, Record &record, StringInterner *interner)
+{
+    record = Record();
+    if (!value.is_object())
+    {
+        return false;
+    }
+
+    json extra_members = json::object();
+    for (auto it = value.begin(); it != value.end(); ++it)
+    {
+        const auto *name = find(FIELD_NAMES, FIELD_NAMES + FIELD_COUNT, it.key());
+        const json &member = it.value();
+        bool stored = false;
+
+        if (it.key() == RECEIVED_KEY && member.is_number_unsigned())
+        {
+            record.received_ns = member.get<uint64_t>();
+            stored = record.received_ns != 0;
+        }
+        else if (it.key() == SENDER_KEY && member.is_string())
+        {
+            stored = parse_sender(member.get_ref<const string &>(), record.sender_ip, record.sender_port);
+        }
+        else if (name != FIELD_NAMES + FIELD_COUNT)
+        {
+            RecordField &field = record.fields[name - FIELD_NAMES];
+            StringInterner *values = name - FIELD_NAMES != DATA ? interner : nullptr;
+            if (member.is_string())
+            {
+                string_view text = store_value(member.get_ref<const string &>(), arena, values);
+                field.ptr = text.data();
+                field.length = static_cast<uint32_t>(text.size());
+                field.kind = FieldKind::String;
+                stored = true;
+            }
+            else if (member.is_array() && all_of(member.begin(), member.end(), [](const json &item)
+                                                 { return item.is_string(); }))
+            {
+                auto *items = reinterpret_cast<string_view *>(arena.allocate(member.size() * sizeof(string_view), alignof(string_view)));
+                for (size_t i = 0; i < member.size(); ++i)
+                {
+                    new (&items[i]) string_view(store_value(member[i].get_ref<const string &>(), arena, values));
+                }
+                field.ptr = items;
+                field.length = static_cast<uint32_t>(member.size());
+                field.kind = FieldKind::List;
+                stored = true;
+            }
+        }
+
+        if (!stored)
+        {
+            extra_members[it.key()] = member;
+        }
+    }
+
+    if (!extra_members.empty())
+    {
+        record.extra = arena.copy(extra_members.dump());
+    }
+    return true;
+}
+
+void RecordParser::skipWhitespace()
+{
+    while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+    {
+        ++pos;
+    }
+}
+
+static bool is_continuation(const char *p, const char *end)
+{
+    return p < end && (static_cast<unsigned char>(*p) & 0xC0) == 0x80;
+}
+
+size_t utf8_sequence_length(const char *p, const char *end)
+{
+    unsigned char c = static_cast<unsigned char>(p[0]);
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+        return is_continuation(p + 1, end) ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF)
+    {
+        if (!is_continuation(p + 1, end) || !is_continuation(p + 2, end))
+        {
+            return 0;
+        }
+        unsigned char c1 = static_cast<unsigned char>(p[1]);
+        if ((c == 0xE0 && c1 < 0xA0) || (c == 0xED && c1 > 0x9F))
+        {
+            return 0; // Overlong, or a UTF-16 surrogate
+        }
+        return 3;
+    }
+    if (c >= 0xF0 && c <= 0xF4)
+    {
+        if (!is_continuation(p + 1, end) || !is_continuation(p + 2, end) || !is_continuation(p + 3, end))
+        {
+            return 0;
+        }
+        unsigned char c1 = static_cast<unsigned char>(p[1]);
+        if ((c == 0xF0 && c1 < 0x90) || (c == 0xF4 && c1 > 0x8F))
+        {
+            return 0;
+        }
+        return 4;
+    }
+    return 0;
+}
+
+static bool parse_hex4(const char *p, const char *end, unsigned &value)
+{
+    if (end - p < 4)
+    {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+static void append_utf8(string &out, unsigned cp)
+{
+    if (cp < 0x80)
+    {
+        out += static_cast<char>(cp);
+    }
+    else if (cp < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+string_view RecordParser::store(const char *data, size_t length)
+{
+    if (!intern_strings)
+    {
+        return arena->copy(data, length);
+    }
+
+    InternStats &stats = intern_stats[intern_field];
+    const string_view text(data, length);
+    string_view canonical;
+    uint32_t id = interner->find(text, canonical);
+    if (id == StringInterner::NONE)
+    {
+        stats.misses++;
+        if (stats.insert)
+        {
+            id = interner->intern(text, canonical);
+        }
+    }
+    if (++stats.values == INTERN_WINDOW)
+    {
+        stats.insert = stats.misses * 4 < stats.values; // Fewer than a quarter new
+        stats.values = 0;
+        stats.misses = 0;
+    }
+    return id != StringInterner::NONE ? canonical : arena->copy(data, length);
+}
+
+// Parses a string value starting at the opening quote and copies it into the
+// arena (or takes it from the interner)
+bool RecordParser::parseString(string_view &out)
+{
+    if (pos >= end || *pos != '"')
+    {
+        return false;
+    }
+    ++pos;
+
+    // Fast path: no escapes, copy the raw bytes in one go
+    const char *start = pos;
+    bool escaped = false;
+    while (pos < end)
+    {
+        unsigned char c = static_cast<unsigned char>(*pos);
+        if (c == '"')
+        {
+            break;
+        }
+        if (c == '\\')
+        {
+            escaped = true;
+            break;
+        }
+        if (c < 0x20)
+        {
+            return false;
+        }
+        if (c < 0x80)
+        {
+            ++pos;
+            continue;
+        }
+        size_t n = utf8_sequence_length(pos, end);
+        if (n == 0)
+        {
+            return false;
+        }
+        pos += n;
+    }
+    if (pos >= end)
+    {
+        return false;
+    }
+    if (!escaped)
+    {
+        out = store(start, pos - start);
+        ++pos;
+        return true;
+    }
+
+    // Slow path: unescape into scratch space first
+    scratch_text.assign(start, pos);
+    while (pos < end && *pos != '"')
+    {
+        unsigned char c = static_cast<unsigned char>(*pos);
+        if (c < 0x20)
+        {
+            return false;
+        }
+        if (c >= 0x80)
+        {
+            size_t n = utf8_sequence_length(pos, end);
+            if (n == 0)
+            {
+                return false;
+            }
+            scratch_text.append(pos, n);
+            pos += n;
+            continue;
+        }
+        if (c != '\\')
+        {
+            scratch_text += static_cast<char>(c);
+            ++pos;
+            continue;
+        }
+
+        if (++pos >= end)
+        {
+            return false;
+        }
+        switch (*pos++)
+        {
+        case '"':
+            scratch_text += '"';
+            break;
+        case '\\':
+            scratch_text += '\\';
+            break;
+        case '/':
+            scratch_text += '/';
+            break;
+        case 'b':
+            scratch_text += '\b';
+            break;
+        case 'f':
+            scratch_text += '\f';
+            break;
+        case 'n':
+            scratch_text += '\n';
+            break;
+        case 'r':
+            scratch_text += '\r';
+            break;
+        case 't':
+            scratch_text += '\t';
+            break;
+        case 'u':
+        {
+            unsigned cp;
+            if (!parse_hex4(pos, end, cp))
+            {
+                return false;
+            }
+            pos += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF)
+            {
+                unsigned low;
+                if (end - pos < 6 || pos[0] != '\\' || pos[1] != 'u' || !parse_hex4(pos + 2, end, low) || low < 0xDC00 || low > 0xDFFF)
+                {
+                    return false;
+                }
+                pos += 6;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            else if (cp >= 0xDC00 && cp <= 0xDFFF)
+            {
+                return false;
+            }
+            append_utf8(scratch_text, cp);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    if (pos >= end)
+    {
+        return false;
+    }
+    ++pos;
+    out = store(scratch_text.data(), scratch_text.size());
+    return true;
+}
+
+// Keys must be one of the schema names, written without escapes
+bool RecordParser::parseKey(int &field)
+{
+    if (pos >= end || *pos != '"')
+    {
+        return false;
+    }
+    const char *start = ++pos;
+    const char *quote = static_cast<const char *>(memchr(pos, '"', end - pos));
+    if (quote == nullptr)
+    {
+        return false;
+    }
+    string_view key(start, quote - start);
+    pos = quote + 1;
+
+    for (size_t i = 0; i < Record::FIELD_COUNT; ++i)
+    {
+        if (key == Record::FIELD_NAMES[i])
+        {
+            field = static_cast<int>(i);
+            return true;
+        }
+    }
+    if (key == RECEIVED_KEY || key == SENDER_KEY)
+    {
+        field = key == RECEIVED_KEY ? RECEIVED_INDEX : SENDER_INDEX;
+        return true;
+    }
+    return false;
+}
+
+// A positive integer receive time, or a valid sender address; anything else
+// is left to the generic path (which keeps it in extra)
+bool RecordParser::parseMetadata(int key, Record &record)
+{
+    if (key == SENDER_INDEX)
+    {
+        Arena::Mark mark = arena->mark();
+        string_view text;
+        bool ok = parseString(text) && parse_sender(text, record.sender_ip, record.sender_port);
+        arena->rewind(mark); // The text is not kept
+        return ok;
+    }
+
+    uint64_t value = 0;
+    const char *start = pos;
+    while (pos < end && *pos >= '0' && *pos <= '9')
+    {
+        unsigned digit = *pos - '0';
+        if (value > (UINT64_MAX - digit) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + digit;
+        ++pos;
+    }
+    if (pos == start || (*start == '0' && pos - start > 1) || value == 0 ||
+        (pos < end && (*pos == '.' || *pos == 'e' || *pos == 'E')))
+    {
+        return false;
+    }
+    record.received_ns = value;
+    return true;
+}
+
+bool RecordParser::parseList(RecordField &field)
+{
+    ++pos; // '['
+    scratch_items.clear();
+    skipWhitespace();
+    if (pos < end && *pos == ']')
+    {
+        ++pos;
+    }
+    else
+    {
+        while (true)
+        {
+            string_view item;
+            skipWhitespace();
+            if (!parseString(item))
+            {
+                return false;
+            }
+            scratch_items.push_back(item);
+            skipWhitespace();
+            if (pos >= end)
+            {
+                return false;
+            }
+            if (*pos == ',')
+            {
+                ++pos;
+                continue;
+            }
+            if (*pos == ']')
+            {
+                ++pos;
+                break;
+            }
+            return false;
+        }
+    }
+
+    auto *items = reinterpret_cast<string_view *>(arena->allocate(scratch_items.size() * sizeof(string_view), alignof(string_view)));
+    copy(scratch_items.begin(), scratch_items.end(), items);
+    field.ptr = items;
+    field.length = static_cast<uint32_t>(scratch_items.size());
+    field.kind = FieldKind::List;
+    return true;
+}
+
+bool RecordParser::parse(const char *data, size_t length, Arena &target, Record &record)
+{
+    pos = data;
+    end = data + length;
+    arena = &target;
+    intern_strings = false;
+    Arena::Mark mark = target.mark();
+    record = Record();
+
+    bool ok = [&]
+    {
+        skipWhitespace();
+        if (pos >= end || *pos != '{')
+        {
+            return false;
+        }
+        ++pos;
+        skipWhitespace();
+        if (pos < end && *pos == '}')
+        {
+            ++pos;
+        }
+        else
+        {
+            while (true)
+            {
+                int index;
+                skipWhitespace();
+                if (!parseKey(index))
+                {
+                    return false;
+                }
+                skipWhitespace();
+                if (pos >= end || *pos != ':')
+                {
+                    return false;
+                }
+                ++pos;
+                skipWhitespace();
+                if (pos >= end)
+                {
+                    return false;
+                }
+
+                // Later duplicates win, as with nlohmann::json
+                intern_strings = interner != nullptr && index != Record::DATA &&
+                                 index < static_cast<int>(Record::FIELD_COUNT);
+                intern_field = index;
+                if (index >= static_cast<int>(Record::FIELD_COUNT))
+                {
+                    if (!parseMetadata(index, record))
+                    {
+                        return false;
+                    }
+                }
+                else if (*pos == '"')
+                {
+                    RecordField &field = record.fields[index];
+                    string_view text;
+                    if (!parseString(text))
+                    {
+                        return false;
+                    }
+                    field.ptr = text.data();
+                    field.length = static_cast<uint32_t>(text.size());
+                    field.kind = FieldKind::String;
+                }
+                else if (*pos == '[')
+                {
+                    if (!parseList(record.fields[index]))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    return false;
+                }
+
+                skipWhitespace();
+                if (pos >= end)
+                {
+                    return false;
+                }
+                if (*pos == ',')
+                {
+                    ++pos;
+                    continue;
+                }
+                if (*pos == '}')
+                {
+                    ++pos;
+                    break;
+                }
+                return false;
+            }
+        }
+        skipWhitespace();
+        return pos == end;
+    }();
+
+    if (!ok)
+    {
+        target.rewind(mark);
+        record = Record();
+    }
+    return ok;
+}
@@ -0,0 +1,194 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Bump allocator for record strings. Memory is only released when the arena
+// is destroyed (or rewound to a mark), so string_views into it stay valid for
+// the arena's lifetime.
+class Arena
+{
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+
+    char *allocate(size_t size, size_t align = 1);
+    std::string_view copy(const char *data, size_t size);
+    std::string_view copy(std::string_view text) { return copy(text.data(), text.size()); }
+
+    struct Mark
+    {
+        size_t block;
+        size_t used;
+    };
+
+    // Allocations made after mark() are discarded by rewind(mark)
+    Mark mark() const { return {current, used}; }
+    void rewind(const Mark &m);
+
+    // Bytes handed out, and bytes reserved from the heap
+    size_t bytesUsed() const;
+    size_t bytesReserved() const;
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t block_size;
+    std::vector<Block> blocks;
+    size_t current;
+    size_t used;
+};
+
+enum class FieldKind : uint8_t
+{
+    Missing,
+    String,
+    List
+};
+
+// One schema field: either a string or a list of strings. All text lives in
+// an Arena owned by whoever owns the record.
+struct RecordField
+{
+    const void *ptr = nullptr;
+    uint32_t length = 0; // Bytes for a string, items for a list
+    FieldKind kind = FieldKind::Missing;
+
+    std::string_view str() const { return std::string_view(static_cast<const char *>(ptr), length); }
+    const std::string_view *begin() const { return static_cast<const std::string_view *>(ptr); }
+    const std::string_view *end() const { return begin() + length; }
+    size_t size() const { return length; }
+};
+
+class StringInterner;
+
+// Typed form of one received datagram. Replaces a per-record nlohmann::json
+// DOM; fields are indexed in FIELD_NAMES order, which is also the order the
+// report draws them in.
+struct Record
+{
+    static const size_t FIELD_COUNT = 6;
+    static const char *const FIELD_NAMES[FIELD_COUNT];
+
+    enum Field
+    {
+        CMD_NAME,
+        DATA,
+        RANGE,
+        STATUS,
+        INPUT_OTHER,
+        OUTPUT_OTHER
+    };
+
+    RecordField fields[FIELD_COUNT];
+
+    // Compact JSON object holding any members outside the schema (or schema
+    // keys with unexpected types); empty when there are none
+    std::string_view extra;
+
+    // Stamped by the receiving worker; zero when unknown. In JSON they are
+    // the members "_received_ns" (an integer) and "_sender" ("a.b.c.d:port").
+    uint64_t received_ns = 0; // Kernel receive time, nanoseconds since the epoch
+    uint32_t sender_ip = 0;   // IPv4 address, network byte order
+    uint16_t sender_port = 0;
+
+    std::string senderText() const;
+
+    const RecordField &operator[](Field f) const { return fields[f]; }
+
+    // Builds the equivalent JSON object (same members as the original datagram)
+    nlohmann::json toJson() const;
+
+    // Appends the same object as compact JSON text, without building a DOM
+    void appendJson(std::string &out) const;
+
+    // Generic path: converts any JSON object. Returns false (leaving an empty
+    // record) if value is not an object. With an interner, repeated values
+    // (every field but data) are taken from it instead of copied.
+    static bool fromJson(const nlohmann::json &value, Arena &arena, Record &record,
+                         StringInterner *interner = nullptr);
+};
+
+// Selects the records a report shows. Every condition that is set must hold;
+// a default filter matches everything.
+struct RecordFilter
+{
+    uint64_t received_from_ns = 0; // Records without a receive time never match a time bound
+    uint64_t received_to_ns = UINT64_MAX;
+    std::vector<std::string> statuses;  // Any of these; empty means any
+    std::vector<std::string> cmd_names; // Any of these; empty means any
+
+    bool timeBounded() const { return received_from_ns > 0 || received_to_ns < UINT64_MAX; }
+    bool empty() const { return !timeBounded() && statuses.empty() && cmd_names.empty(); }
+    bool matches(const Record &record) const;
+};
+
+// Length of the UTF-8 sequence starting at p, or 0 if it is not valid (RFC 3629)
+size_t utf8_sequence_length(const char *p, const char *end);
+
+// Hand-rolled parser for the fixed record schema. Reads straight from the
+// receive buffer and copies strings into the arena, without building a DOM.
+// Each ingestion worker owns one (it keeps scratch space between calls).
+class RecordParser
+{
+public:
+    // With an interner, every field but data is interned instead of copied
+    // into the arena (when the interner is full, it is copied after all)
+    explicit RecordParser(StringInterner *interner = nullptr) : interner(interner) {}
+
+    // Returns true if the text is a valid JSON object whose members are all
+    // schema fields holding strings or lists of strings (or well-formed
+    // receive metadata, see Record). Anything else (unknown
+    // members, other value types, malformed input) returns false with the arena
+    // left untouched; the caller then takes the generic nlohmann::json path.
+    bool parse(const char *data, size_t length, Arena &arena, Record &record);
+
+private:
+    const char *pos = nullptr;
+    const char *end = nullptr;
+    Arena *arena = nullptr;
+    StringInterner *interner;
+    bool intern_strings = false; // For the value being parsed
+    int intern_field = 0;        // Its field
+
+    // Values of a field whose lookups mostly miss (ids, free text) do not
+    // repeat; inserting them would only fill the interner and contend for its
+    // lock. Every INTERN_WINDOW values the field's miss rate decides whether
+    // its new values are inserted or copied for the next window; known
+    // values are always shared.
+    static const uint32_t INTERN_WINDOW = 4096;
+    struct InternStats
+    {
+        uint32_t values = 0;
+        uint32_t misses = 0;
+        bool insert = true;
+    };
+    InternStats intern_stats[Record::FIELD_COUNT];
+    std::vector<std::string_view> scratch_items;
+    std::string scratch_text;
+
+    void skipWhitespace();
+    bool parseKey(int &field);
+    bool parseMetadata(int key, Record &record);
+    bool parseString(std::string_view &out);
+    std::string_view store(const char *data, size_t length);
+    bool parseList(RecordField &field);
+};
+
+#endif
@@ -0,0 +1,405 @@
+#include "record_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char RECORD_FILE_MAGIC[4] = {'U', 'R', 'F', '2'};
+static const size_t VERSIONLESS_MAGIC_SIZE = 3;
+static const size_t FOOTER_SIZE = 5 * sizeof(uint64_t) + sizeof(RECORD_FILE_MAGIC);
+static const size_t BLOCK_WORDS = 4; // Earliest, latest, status mask, cmd_name mask
+
+static_assert(Record::FIELD_COUNT <= 8, "field masks are one byte");
+
+static void append_varint(string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static void append_uint64(string &out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out += static_cast<char>(value >> (8 * i));
+    }
+}
+
+static uint64_t read_uint64(const char *p)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return value;
+}
+
+RecordFileWriter::RecordFileWriter(const string &path)
+    : path(path), out(path, ios::binary | ios::trunc), offset(sizeof(RECORD_FILE_MAGIC))
+{
+    if (!out.is_open())
+    {
+        throw runtime_error("Could not create record file: " + path);
+    }
+    out.write(RECORD_FILE_MAGIC, sizeof(RECORD_FILE_MAGIC));
+}
+
+uint32_t RecordFileWriter::stringId(string_view text)
+{
+    string_view stored;
+    return strings.intern(text, stored);
+}
+
+void RecordFileWriter::append(const Record &record)
+{
+    if (record_offsets.size() % BLOCK_RECORDS == 0)
+    {
+        blocks.insert(blocks.end(), {UINT64_MAX, 0, 0, 0});
+    }
+    uint64_t *block = &blocks[blocks.size() - BLOCK_WORDS];
+    if (record.received_ns != 0)
+    {
+        block[0] = min(block[0], record.received_ns);
+        block[1] = max(block[1], record.received_ns);
+    }
+
+    scratch.assign(2, '\0');
+    for (size_t i = 0; i < Record::FIELD_COUNT; ++i)
+    {
+        const RecordField &field = record.fields[i];
+        if (field.kind == FieldKind::Missing)
+        {
+            continue;
+        }
+        scratch[0] |= static_cast<char>(1 << i);
+        if (field.kind == FieldKind::String)
+        {
+            uint32_t id = stringId(field.str());
+            append_varint(scratch, id);
+            if (i == Record::STATUS || i == Record::CMD_NAME)
+            {
+                block[i == Record::STATUS ? 2 : 3] |= uint64_t(1) << (id % 64);
+            }
+        }
+        else
+        {
+            scratch[1] |= static_cast<char>(1 << i);
+            append_varint(scratch, field.size());
+            for (const auto &item : field)
+            {
+                append_varint(scratch, stringId(item));
+            }
+        }
+    }
+    append_varint(scratch, record.extra.empty() ? 0 : uint64_t(stringId(record.extra)) + 1);
+    append_varint(scratch, record.received_ns);
+    append_varint(scratch, record.sender_ip);
+    append_varint(scratch, record.sender_port);
+
+    record_offsets.push_back(offset);
+    out.write(scratch.data(), scratch.size());
+    offset += scratch.size();
+}
+
+void RecordFileWriter::finish()
+{
+    const uint64_t string_table = offset;
+    string tail;
+    uint64_t blob_size = 0;
+    append_uint64(tail, 0);
+    for (uint32_t id = 0; id < strings.size(); ++id)
+    {
+        blob_size += strings.text(id).size();
+        append_uint64(tail, blob_size);
+    }
+    out.write(tail.data(), tail.size());
+    for (uint32_t id = 0; id < strings.size(); ++id)
+    {
+        string_view text = strings.text(id);
+        out.write(text.data(), text.size());
+    }
+
+    const uint64_t record_index = string_table + tail.size() + blob_size;
+    tail.clear();
+    for (uint64_t record_offset : record_offsets)
+    {
+        append_uint64(tail, record_offset);
+    }
+    const uint64_t block_index = record_index + tail.size();
+    for (uint64_t word : blocks)
+    {
+        append_uint64(tail, word);
+    }
+    append_uint64(tail, string_table);
+    append_uint64(tail, strings.size());
+    append_uint64(tail, record_index);
+    append_uint64(tail, record_offsets.size());
+    append_uint64(tail, block_index);
+    tail.append(RECORD_FILE_MAGIC, sizeof(RECORD_FILE_MAGIC));
+    out.write(tail.data(), tail.size());
+
+    out.close();
+    if (out.fail())
+    {
+        throw runtime_error("Failed to write record file: " + path);
+    }
+}
+
+bool RecordFile::detect(const string &path)
+{
+    char magic[VERSIONLESS_MAGIC_SIZE];
+    ifstream file(path, ios::binary);
+    return file.read(magic, sizeof(magic)) && memcmp(magic, RECORD_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+RecordFile::RecordFile(const string &path)
+    : path(path), data(nullptr), length(0)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw runtime_error("Could not open record file: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        length = static_cast<size_t>(st.st_size);
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = mapping == MAP_FAILED ? nullptr : static_cast<const char *>(mapping);
+    }
+    close(fd);
+    if (data == nullptr)
+    {
+        length = 0;
+        invalid("cannot be mapped");
+    }
+    // Records are mostly read front to back
+    madvise(const_cast<char *>(data), length, MADV_SEQUENTIAL);
+
+    if (length >= sizeof(RECORD_FILE_MAGIC) && memcmp(data, RECORD_FILE_MAGIC, VERSIONLESS_MAGIC_SIZE) == 0 &&
+        data[VERSIONLESS_MAGIC_SIZE] != RECORD_FILE_MAGIC[VERSIONLESS_MAGIC_SIZE])
+    {
+        invalid("unsupported version (convert the input again)");
+    }
+    if (length < sizeof(RECORD_FILE_MAGIC) + FOOTER_SIZE || memcmp(data, RECORD_FILE_MAGIC, sizeof(RECORD_FILE_MAGIC)) != 0 ||
+        memcmp(data + length - sizeof(RECORD_FILE_MAGIC), RECORD_FILE_MAGIC, sizeof(RECORD_FILE_MAGIC)) != 0)
+    {
+        invalid("bad magic");
+    }
+    const char *footer = data + length - FOOTER_SIZE;
+    records_end = read_uint64(footer);
+    string_count = read_uint64(footer + 8);
+    uint64_t record_index = read_uint64(footer + 16);
+    record_count = read_uint64(footer + 24);
+    uint64_t block_index = read_uint64(footer + 32);
+
+    // Tables in order, each inside the file (divisions avoid overflow)
+    const uint64_t tables_end = length - FOOTER_SIZE;
+    if (records_end < sizeof(RECORD_FILE_MAGIC) || records_end > tables_end ||
+        string_count >= (tables_end - records_end) / 8)
+    {
+        invalid("bad string table");
+    }
+    string_offsets = data + records_end;
+    blob = string_offsets + (string_count + 1) * 8;
+    uint64_t blob_size = read_uint64(string_offsets + string_count * 8);
+    if (read_uint64(string_offsets) != 0 || blob_size > tables_end - (blob - data) ||
+        record_index != static_cast<uint64_t>(blob - data) + blob_size || block_index < record_index ||
+        block_index > tables_end || record_count != (block_index - record_index) / 8 || (block_index - record_index) % 8 != 0)
+    {
+        invalid("bad record index");
+    }
+    record_offsets = data + record_index;
+
+    block_count = (record_count + RecordFileWriter::BLOCK_RECORDS - 1) / RecordFileWriter::BLOCK_RECORDS;
+    if (tables_end - block_index != block_count * BLOCK_WORDS * 8)
+    {
+        invalid("bad block index");
+    }
+    blocks = data + block_index;
+}
+
+RecordFile::~RecordFile()
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+}
+
+void RecordFile::invalid(const string &what)
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+    throw runtime_error("Invalid record file " + path + ": " + what);
+}
+
+string_view RecordFile::stringAt(uint64_t id) const
+{
+    if (id >= string_count)
+    {
+        throw runtime_error("Corrupt record file " + path + ": bad string id");
+    }
+    uint64_t begin = read_uint64(string_offsets + id * 8);
+    uint64_t end = read_uint64(string_offsets + (id + 1) * 8);
+    if (begin > end || end > read_uint64(string_offsets + string_count * 8))
+    {
+        throw runtime_error("Corrupt record file " + path + ": bad string offset");
+    }
+    return string_view(blob + begin, end - begin);
+}
+
+void RecordFile::read(size_t i, Arena &arena, Record &record) const
+{
+    record = Record();
+    if (i >= record_count)
+    {
+        throw out_of_range("record index");
+    }
+    uint64_t begin = read_uint64(record_offsets + i * 8);
+    uint64_t end = i + 1 < record_count ? read_uint64(record_offsets + (i + 1) * 8) : records_end;
+    if (begin < sizeof(RECORD_FILE_MAGIC) || begin > end || end - begin < 2 || end > records_end)
+    {
+        throw runtime_error("Corrupt record file " + path + ": bad record offset");
+    }
+    const char *p = data + begin;
+    const char *limit = data + end;
+
+    auto varint = [&]()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (p == limit)
+            {
+                break;
+            }
+            unsigned char byte = static_cast<unsigned char>(*p++);
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        throw runtime_error("Corrupt record file " + path + ": truncated record");
+    };
+
+    unsigned char present = static_cast<unsigned char>(*p++);
+    unsigned char lists = static_cast<unsigned char>(*p++);
+    for (size_t f = 0; f < Record::FIELD_COUNT; ++f)
+    {
+        if ((present & (1 << f)) == 0)
+        {
+            continue;
+        }
+        RecordField &field = record.fields[f];
+        if ((lists & (1 << f)) == 0)
+        {
+            string_view text = stringAt(varint());
+            field.ptr = text.data();
+            field.length = static_cast<uint32_t>(text.size());
+            field.kind = FieldKind::String;
+            continue;
+        }
+
+        // Every item takes at least a byte, which bounds the count
+        uint64_t count = varint();
+        if (count > static_cast<uint64_t>(limit - p))
+        {
+            throw runtime_error("Corrupt record file " + path + ": bad list length");
+        }
+        auto *items = reinterpret_cast<string_view *>(arena.allocate(count * sizeof(string_view), alignof(string_view)));
+        for (uint64_t j = 0; j < count; ++j)
+        {
+            items[j] = stringAt(varint());
+        }
+        field.ptr = items;
+        field.length = static_cast<uint32_t>(count);
+        field.kind = FieldKind::List;
+    }
+    uint64_t extra = varint();
+    if (extra > 0)
+    {
+        record.extra = stringAt(extra - 1);
+    }
+    record.received_ns = varint();
+    record.sender_ip = static_cast<uint32_t>(varint());
+    record.sender_port = static_cast<uint16_t>(varint());
+}
+
+// Bits a block mask has set if it holds any of the wanted strings. One pass
+// over the dictionary; strings it lacks cannot match at all.
+uint64_t RecordFile::idMask(const vector<std::string> &wanted) const
+{
+    uint64_t mask = 0;
+    for (uint64_t id = 0; id < string_count; ++id)
+    {
+        if (find(wanted.begin(), wanted.end(), stringAt(id)) != wanted.end())
+        {
+            mask |= uint64_t(1) << (id % 64);
+        }
+    }
+    return mask;
+}
+
+void RecordFile::select(const RecordFilter &filter, Arena &arena, bool keep,
+                        const function<void(const Record &)> &visit) const
+{
+    const uint64_t status_mask = filter.statuses.empty() ? UINT64_MAX : idMask(filter.statuses);
+    const uint64_t cmd_mask = filter.cmd_names.empty() ? UINT64_MAX : idMask(filter.cmd_names);
+
+    for (uint64_t b = 0; b < block_count; ++b)
+    {
+        const char *block = blocks + b * BLOCK_WORDS * 8;
+        uint64_t earliest = read_uint64(block);
+        uint64_t latest = read_uint64(block + 8);
+        if (filter.timeBounded() && (earliest > latest || latest < filter.received_from_ns || earliest > filter.received_to_ns))
+        {
+            continue;
+        }
+        if ((read_uint64(block + 16) & status_mask) == 0 || (read_uint64(block + 24) & cmd_mask) == 0)
+        {
+            continue;
+        }
+
+        size_t end = min<uint64_t>(record_count, (b + 1) * RecordFileWriter::BLOCK_RECORDS);
+        for (size_t i = b * RecordFileWriter::BLOCK_RECORDS; i < end; ++i)
+        {
+            Arena::Mark mark = arena.mark();
+            Record record;
+            read(i, arena, record);
+            bool match = filter.matches(record);
+            if (match)
+            {
+                visit(record);
+            }
+            if (!match || !keep)
+            {
+                arena.rewind(mark);
+            }
+        }
+    }
+}
+
+uint64_t RecordFile::latestReceived() const
+{
+    uint64_t latest = 0;
+    for (uint64_t b = 0; b < block_count; ++b)
+    {
+        latest = max(latest, read_uint64(blocks + b * BLOCK_WORDS * 8 + 8));
+    }
+    return latest;
+}
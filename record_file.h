@@ -0,0 +1,120 @@
+#ifndef RECORD_FILE_H
+#define RECORD_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "record.h"
+#include "string_interner.h"
+
+// Compact binary container for records (".urf"). Every distinct string is
+// stored once in a dictionary and records refer to it by id, so repeated
+// values (command names, statuses, ...) cost a byte or two each. Layout,
+// integers little-endian:
+//
+//   "URF2"
+//   records      per record: present mask, list mask (bit i = field i), then
+//                for each present field in order a varint string id, or a
+//                varint item count followed by that many ids; then a varint
+//                extra id + 1 (0 when there are no extra members); last the
+//                receive time, sender address and port as varints
+//   string table uint64 offsets[count + 1] into the blob, then the blob
+//   record index uint64 offset of each record from the start of the file
+//   block index  per BLOCK_RECORDS records: uint64 earliest and latest
+//                receive time, and masks of the status and cmd_name string
+//                ids present (bit id % 64)
+//   footer       uint64 string table offset, string count, record index
+//                offset, record count, block index offset; "URF2"
+//
+// The footer makes the file readable from the end, so records can be decoded
+// one at a time, in any order, without reading the rest. The block index is
+// a sparse index: a filtered read skips every block that cannot hold a match.
+
+// Writes records to a .urf file. The dictionary is kept in memory until
+// finish(), so memory grows with the number of distinct strings, not records.
+class RecordFileWriter
+{
+public:
+    static const size_t BLOCK_RECORDS = 256;
+
+    // Throws runtime_error if the file cannot be created
+    explicit RecordFileWriter(const std::string &path);
+
+    RecordFileWriter(const RecordFileWriter &) = delete;
+    RecordFileWriter &operator=(const RecordFileWriter &) = delete;
+
+    void append(const Record &record);
+
+    // Writes the dictionary, the index and the footer. Throws runtime_error
+    // on a write error.
+    void finish();
+
+    uint64_t recordCount() const { return record_offsets.size(); }
+
+private:
+    std::string path;
+    std::ofstream out;
+    uint64_t offset;
+    std::string scratch;
+    StringInterner strings; // Ids are dense, so they double as table indices
+    std::vector<uint64_t> record_offsets;
+    std::vector<uint64_t> blocks; // Four words per block, as in the file
+
+    uint32_t stringId(std::string_view text);
+};
+
+// Read-only view of a .urf file, memory-mapped. Strings in decoded records
+// point straight into the mapping; only list item arrays are built in the
+// caller's arena. Records stay valid while the file is open.
+class RecordFile
+{
+public:
+    // Maps path and checks its footer and tables. Throws runtime_error if the
+    // file is not a valid record file.
+    explicit RecordFile(const std::string &path);
+    ~RecordFile();
+
+    RecordFile(const RecordFile &) = delete;
+    RecordFile &operator=(const RecordFile &) = delete;
+
+    // True if the file starts like a record file (of any version)
+    static bool detect(const std::string &path);
+
+    size_t size() const { return record_count; }
+
+    // Decodes record i. Throws runtime_error if it is corrupt.
+    void read(size_t i, Arena &arena, Record &record) const;
+
+    // Decodes the records matching filter, in order, and calls visit for
+    // each; blocks the index rules out are never touched. With keep set,
+    // visited records stay valid for the arena's lifetime; otherwise the arena
+    // is rewound after each call.
+    void select(const RecordFilter &filter, Arena &arena, bool keep,
+                const std::function<void(const Record &)> &visit) const;
+
+    // Latest receive time in the file (0 if none has one), from the index
+    uint64_t latestReceived() const;
+
+private:
+    std::string path;
+    const char *data;
+    size_t length;
+    const char *string_offsets; // uint64 each, unaligned
+    const char *blob;
+    uint64_t string_count;
+    const char *record_offsets;
+    uint64_t record_count;
+    uint64_t records_end;
+    const char *blocks; // Four uint64 per block
+    uint64_t block_count;
+
+    std::string_view stringAt(uint64_t id) const;
+    uint64_t idMask(const std::vector<std::string> &wanted) const;
+    [[noreturn]] void invalid(const std::string &what); // Constructor only: unmaps, then throws
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "record_file.h"
+
+// Round trip and corruption checks for .urf files. Writes records, reads
+// them back with read() and select(), then truncates the file at every
+// length and damages every byte and word, expecting either a clean read or a
+// runtime_error. Build with -fsanitize=address to catch reads out of bounds.
+
+using json = nlohmann::json;
+using namespace std;
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what)
+{
+    if (!ok)
+    {
+        cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+static string load(const string &path)
+{
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void save(const string &path, const string &bytes)
+{
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+// Opens the file and decodes everything in it; true if that worked, false
+// if it threw runtime_error. Any other exception is a failure.
+static bool readAll(const string &path, const string &what)
+{
+    try
+    {
+        RecordFile file(path);
+        Arena arena;
+        for (size_t i = 0; i < file.size(); ++i)
+        {
+            Record record;
+            file.read(i, arena, record);
+            string text;
+            record.appendJson(text);
+        }
+        RecordFilter filter;
+        filter.statuses = {"FAIL"};
+        filter.cmd_names = {"cmd_3"};
+        file.select(filter, arena, false, [](const Record &) {});
+        file.latestReceived();
+        return true;
+    }
+    catch (const runtime_error &)
+    {
+        return false;
+    }
+    catch (const exception &e)
+    {
+        check(false, what + ": threw " + e.what() + " instead of runtime_error");
+        return false;
+    }
+}
+
+int main()
+{
+    const string path = (fs::temp_directory_path() / ("record_file_test_" + to_string(getpid()) + ".urf")).string();
+    const size_t RECORDS = 300; // Two blocks
+
+    Arena arena;
+    vector<Record> records(RECORDS);
+    vector<string> expected;
+    {
+        RecordFileWriter writer(path);
+        for (size_t i = 0; i < RECORDS; ++i)
+        {
+            json value = {{"cmd_name", "cmd_" + to_string(i % 7)},
+                          {"data", "payload " + to_string(i)},
+                          {"range", {"lo", to_string(i)}},
+                          {"status", i % 3 == 0 ? "FAIL" : "PASS"},
+                          {"_received_ns", 1000 + i}};
+            if (i % 5 == 0)
+            {
+                value["note"] = i;
+            }
+            check(Record::fromJson(value, arena, records[i]), "fromJson " + to_string(i));
+            writer.append(records[i]);
+            expected.emplace_back();
+            records[i].appendJson(expected.back());
+        }
+        writer.finish();
+    }
+
+    // Round trip
+    {
+        RecordFile file(path);
+        check(file.size() == RECORDS, "record count");
+        check(file.latestReceived() == 1000 + RECORDS - 1, "latest receive time");
+        Arena read_arena;
+        for (size_t i = 0; i < file.size(); ++i)
+        {
+            Record record;
+            file.read(i, read_arena, record);
+            string text;
+            record.appendJson(text);
+            check(text == expected[i], "read " + to_string(i) + ": " + text);
+        }
+
+        RecordFilter filter;
+        filter.statuses = {"FAIL"};
+        filter.cmd_names = {"cmd_3"};
+        filter.received_from_ns = 1100;
+        vector<string> selected;
+        file.select(filter, read_arena, true, [&](const Record &record)
+                    {
+            selected.emplace_back();
+            record.appendJson(selected.back()); });
+        vector<string> wanted;
+        for (size_t i = 100; i < RECORDS; ++i)
+        {
+            if (i % 3 == 0 && i % 7 == 3)
+            {
+                wanted.push_back(expected[i]);
+            }
+        }
+        check(!wanted.empty() && selected == wanted, "select");
+    }
+
+    const string good = load(path);
+
+    // Truncated at every length: the footer is gone, so none may open
+    for (size_t size = 0; size < good.size(); ++size)
+    {
+        save(path, good.substr(0, size));
+        check(!readAll(path, "truncated to " + to_string(size)), "truncated to " + to_string(size) + " opened");
+    }
+
+    // Every byte damaged in ways that hit lengths, offsets and varints
+    const unsigned char DAMAGE[] = {0xFF, 0x80, 0x00, 0x7F};
+    for (size_t at = 0; at < good.size(); ++at)
+    {
+        for (unsigned char byte : DAMAGE)
+        {
+            string bad = good;
+            bad[at] = static_cast<char>(byte);
+            save(path, bad);
+            readAll(path, "byte " + to_string(at) + " set to " + to_string(byte));
+        }
+    }
+
+    // Whole words set to values near the top of their range, which bounds
+    // checks must reject without wrapping around: each footer field and the
+    // first record offset
+    const size_t FOOTER = good.size() - 4 - 5 * 8;
+    uint64_t record_index = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        record_index = (record_index << 8) | static_cast<unsigned char>(good[FOOTER + 16 + i]);
+    }
+    vector<size_t> words = {record_index};
+    for (size_t i = 0; i < 5; ++i)
+    {
+        words.push_back(FOOTER + i * 8);
+    }
+    for (size_t at : words)
+    {
+        string bad = good;
+        bad.replace(at, 8, "\xfe\xff\xff\xff\xff\xff\xff\xff", 8);
+        save(path, bad);
+        check(!readAll(path, "word at " + to_string(at)), "word at " + to_string(at) + " accepted");
+    }
+
+    remove(path.c_str());
+    if (failures > 0)
+    {
+        cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    cout << "record_file_test: all checks passed\n";
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include "record_scanner.h"
+
+#include <algorithm>
+#include <cstring>
+#include "record.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+static const struct
+{
+    const char *name;
+    const char *text;
+} REASONS[REJECT_REASONS] = {
+    {"none", "accepted"},
+    {"empty", "empty record"},
+    {"too_large", "record too large"},
+    {"not_object", "record is not a JSON object"},
+    {"bad_utf8", "invalid UTF-8"},
+    {"control_char", "unescaped control character"},
+    {"unbalanced", "unbalanced brackets"},
+    {"unterminated_string", "unterminated string"},
+    {"too_deep", "nested too deeply"},
+    {"missing_key", "required key missing"},
+    {"malformed", "syntax error"},
+};
+
+static const size_t BLOCK = 16;
+
+const char *reject_reason_name(RejectReason reason)
+{
+    return REASONS[static_cast<size_t>(reason)].name;
+}
+
+const char *reject_reason_text(RejectReason reason)
+{
+    return REASONS[static_cast<size_t>(reason)].text;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Bit i is set if byte i of the block is one the scanner has to look at
+static uint32_t block_mask(const char *p)
+{
+#ifdef __SSE2__
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    // '[' and ']' only differ from '{' and '}' in bit 5
+    const __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(folded, _mm_set1_epi8('{')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')));
+    // Control characters are the bytes no greater than 0x1F
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v));
+    // Non-ASCII bytes have the sign bit set
+    return static_cast<uint32_t>(_mm_movemask_epi8(hits) | _mm_movemask_epi8(v));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < BLOCK; ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(p[i]);
+        unsigned char folded = c | 0x20;
+        bool hit = c == '"' || c == '\\' || c == ',' || folded == '{' || folded == '}' || c < 0x20 || c >= 0x80;
+        mask |= uint32_t(hit) << i;
+    }
+    return mask;
+#endif
+}
+
+RecordScanner::RecordScanner(const ScanLimits &limits)
+    : limits(limits)
+{
+    this->limits.max_depth = min<size_t>(this->limits.max_depth, 64);
+    if (this->limits.required_keys.size() > 64)
+    {
+        this->limits.required_keys.resize(64);
+    }
+    const size_t keys = this->limits.required_keys.size();
+    all_keys = keys == 64 ? ~uint64_t(0) : (uint64_t(1) << keys) - 1;
+}
+
+uint64_t RecordScanner::keyBit(const char *key, size_t length) const
+{
+    for (size_t i = 0; i < limits.required_keys.size(); ++i)
+    {
+        const string &required = limits.required_keys[i];
+        if (required.size() == length && memcmp(required.data(), key, length) == 0)
+        {
+            return uint64_t(1) << i;
+        }
+    }
+    return 0;
+}
+
+RejectReason RecordScanner::scan(const char *data, size_t length) const
+{
+    if (limits.max_bytes > 0 && length > limits.max_bytes)
+    {
+        return RejectReason::TooLarge;
+    }
+    size_t begin = 0;
+    size_t end = length;
+    while (begin < end && is_space(data[begin]))
+    {
+        ++begin;
+    }
+    while (end > begin && is_space(data[end - 1]))
+    {
+        --end;
+    }
+    if (begin == end)
+    {
+        return RejectReason::Empty;
+    }
+    if (data[begin] != '{')
+    {
+        return RejectReason::NotObject;
+    }
+
+    uint64_t objects = 0;    // Bit 0 set if the innermost open bracket is '{', bit 1 for the one around it, ...
+    size_t depth = 0;
+    bool in_string = false;
+    bool expect_key = false; // In the top-level object, after '{' or ','
+    bool in_key = false;
+    size_t key_start = 0;
+    size_t skip_to = 0;      // Bytes before this were taken with an escape or a UTF-8 sequence
+    uint64_t keys_seen = 0;
+    char tail[BLOCK];
+
+    for (size_t base = begin; base < end; base += BLOCK)
+    {
+        uint32_t mask;
+        if (end - base >= BLOCK)
+        {
+            mask = block_mask(data + base);
+        }
+        else
+        {
+            // Padded with spaces, which the mask ignores
+            memset(tail, ' ', BLOCK);
+            memcpy(tail, data + base, end - base);
+            mask = block_mask(tail);
+        }
+
+        while (mask != 0)
+        {
+            const size_t i = base + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (i < skip_to)
+            {
+                continue;
+            }
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+
+            if (in_string)
+            {
+                if (c == '"')
+                {
+                    in_string = false;
+                    if (in_key)
+                    {
+                        keys_seen |= keyBit(data + key_start, i - key_start);
+                        in_key = false;
+                    }
+                }
+                else if (c == '\\')
+                {
+                    skip_to = i + 2;
+                }
+                else if (c < 0x20)
+                {
+                    return RejectReason::ControlChar;
+                }
+                else if (c >= 0x80)
+                {
+                    size_t n = utf8_sequence_length(data + i, data + end);
+                    if (n == 0)
+                    {
+                        return RejectReason::BadUtf8;
+                    }
+                    skip_to = i + n;
+                }
+                continue; // Brackets and commas are text here
+            }
+
+            switch (c)
+            {
+            case '"':
+                in_string = true;
+                in_key = expect_key && all_keys != 0;
+                key_start = i + 1;
+                expect_key = false;
+                break;
+            case '{':
+            case '[':
+                if (depth == limits.max_depth)
+                {
+                    return RejectReason::TooDeep;
+                }
+                objects = (objects << 1) | (c == '{');
+                depth++;
+                expect_key = depth == 1;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0 || (objects & 1) != (c == '}'))
+                {
+                    return RejectReason::Unbalanced;
+                }
+                objects >>= 1;
+                depth--;
+                expect_key = false;
+                if (depth == 0 && i + 1 != end)
+                {
+                    return RejectReason::NotObject; // Something follows the object
+                }
+                break;
+            case ',':
+                expect_key = depth == 1;
+                break;
+            case '\t':
+            case '\n':
+            case '\r':
+                break;
+            default:
+                return c < 0x20 ? RejectReason::ControlChar : RejectReason::Malformed;
+            }
+        }
+    }
+
+    if (in_string)
+    {
+        return RejectReason::UnterminatedString;
+    }
+    if (depth != 0)
+    {
+        return RejectReason::Unbalanced;
+    }
+    if ((keys_seen & all_keys) != all_keys)
+    {
+        return RejectReason::MissingKey;
+    }
+    return RejectReason::None;
+}
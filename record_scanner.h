@@ -0,0 +1,64 @@
+#ifndef RECORD_SCANNER_H
+#define RECORD_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Why a record was turned away before (or by) the full parse
+enum class RejectReason : uint8_t
+{
+    None,
+    Empty,              // Nothing but whitespace
+    TooLarge,           // Longer than max_bytes
+    NotObject,          // Not an object, or something follows it
+    BadUtf8,            // Invalid UTF-8 in a string
+    ControlChar,        // Unescaped control character
+    Unbalanced,         // Brackets that do not match up
+    UnterminatedString,
+    TooDeep,            // Nested deeper than max_depth
+    MissingKey,         // A required key is not in the top-level object
+    Malformed           // Any other syntax error
+};
+
+const size_t REJECT_REASONS = static_cast<size_t>(RejectReason::Malformed) + 1;
+
+// Metric label, e.g. "bad_utf8"
+const char *reject_reason_name(RejectReason reason);
+
+// Log text, e.g. "invalid UTF-8"
+const char *reject_reason_text(RejectReason reason);
+
+struct ScanLimits
+{
+    size_t max_bytes = 1024 * 1024;         // Per record; 0 is no limit
+    size_t max_depth = 32;                  // Nesting of objects and arrays, at most 64
+    std::vector<std::string> required_keys; // Top-level members every record must have, at most 64
+};
+
+// Structural pre-check run on every record before it is parsed, so garbage
+// is turned away cheaply and without exceptions. The input goes through 16
+// bytes at a time (SSE2 where available): one compare per kind of byte that
+// matters (quotes, backslashes, brackets, commas, control characters and
+// non-ASCII) gives a bit mask, and only the set bits are looked at, so runs
+// of plain text cost next to nothing. It checks that the record is a single
+// object whose strings are terminated, hold valid UTF-8 and no control
+// characters, whose brackets match up to max_depth, and which has every
+// required key (written without escapes). Anything between those bytes
+// (numbers, literals, colons) is left to the parser.
+class RecordScanner
+{
+public:
+    explicit RecordScanner(const ScanLimits &limits = ScanLimits());
+
+    RejectReason scan(const char *data, size_t length) const;
+
+private:
+    ScanLimits limits;
+    uint64_t all_keys; // One bit per required key
+
+    uint64_t keyBit(const char *key, size_t length) const;
+};
+
+#endif
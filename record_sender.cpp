@@ -0,0 +1,200 @@
+#include "record_sender.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "envelope.h"
+#include "reassembler.h"
+
+using namespace std;
+
+RecordSender::RecordSender(const SenderOptions &options)
+    : options(options), sockfd(-1), batch_records(0), next_message_id(1), datagrams_sent(0), records_sent(0)
+{
+    memset(&destination, 0, sizeof(destination));
+}
+
+RecordSender::~RecordSender()
+{
+    if (sockfd != -1)
+    {
+        flush();
+        close(sockfd);
+    }
+}
+
+bool RecordSender::open(const string &host, uint16_t port)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || result == nullptr)
+    {
+        cerr << "Failed to resolve " << host << endl;
+        return false;
+    }
+    memcpy(&destination, result->ai_addr, sizeof(destination));
+    destination.sin_port = htons(port);
+    freeaddrinfo(result);
+
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        cerr << "Failed to create socket.\n";
+        return false;
+    }
+    return true;
+}
+
+bool RecordSender::send(const Record &record)
+{
+    scratch.clear();
+    record.appendJson(scratch);
+    return send(scratch);
+}
+
+bool RecordSender::send(string_view record_json)
+{
+    // Framing overhead for this record on top of the current batch
+    size_t overhead = options.framed ? Envelope::FRAME_HEADER_SIZE : (batch_records > 0 ? 1 : 0);
+    size_t header = options.framed ? Envelope::FRAME_MAGIC_SIZE : 0;
+
+    if (header + overhead + record_json.size() > options.max_datagram)
+    {
+        // Too big to share a datagram with anything; fragment it on its own
+        closeBatch();
+        if (!queueFragments(record_json))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (batch_records > 0 && batch.size() + overhead + record_json.size() > options.max_datagram)
+        {
+            closeBatch();
+            overhead = options.framed ? Envelope::FRAME_HEADER_SIZE : 0;
+        }
+        if (batch_records == 0)
+        {
+            batch.clear();
+            if (options.framed)
+            {
+                Envelope::beginFramed(batch);
+            }
+            batch_started = chrono::steady_clock::now();
+        }
+
+        if (options.framed)
+        {
+            Envelope::appendFrame(batch, record_json);
+        }
+        else
+        {
+            if (batch_records > 0)
+            {
+                batch += '\n';
+            }
+            batch.append(record_json.data(), record_json.size());
+        }
+        batch_records++;
+    }
+    records_sent++;
+
+    if (queued.size() >= options.max_queued)
+    {
+        return sendQueued();
+    }
+    return poll();
+}
+
+bool RecordSender::poll()
+{
+    if (batch_records > 0 && chrono::steady_clock::now() - batch_started >= chrono::milliseconds(options.max_delay_ms))
+    {
+        closeBatch();
+    }
+    return queued.empty() ? true : sendQueued();
+}
+
+bool RecordSender::flush()
+{
+    closeBatch();
+    return sendQueued();
+}
+
+void RecordSender::closeBatch()
+{
+    if (batch_records == 0)
+    {
+        return;
+    }
+    queued.push_back(move(batch));
+    batch.clear();
+    batch_records = 0;
+}
+
+// Returns false, queueing nothing, if the record needs more fragments than
+// the header can count
+bool RecordSender::queueFragments(string_view record_json)
+{
+    size_t chunk = options.max_datagram > FragmentHeader::SIZE ? options.max_datagram - FragmentHeader::SIZE : 1;
+    size_t count = (record_json.size() + chunk - 1) / chunk;
+    if (count > 0xFFFF)
+    {
+        return false;
+    }
+
+    uint32_t message_id = next_message_id++;
+    for (size_t i = 0; i < count; ++i)
+    {
+        string datagram(FragmentHeader::SIZE, '\0');
+        FragmentHeader::write(&datagram[0], message_id, static_cast<uint16_t>(i), static_cast<uint16_t>(count));
+        size_t offset = i * chunk;
+        datagram.append(record_json.data() + offset, min(chunk, record_json.size() - offset));
+        queued.push_back(move(datagram));
+    }
+    return true;
+}
+
+bool RecordSender::sendQueued()
+{
+    vector<mmsghdr> messages(queued.size());
+    vector<iovec> iovecs(queued.size());
+    for (size_t i = 0; i < queued.size(); ++i)
+    {
+        iovecs[i].iov_base = &queued[i][0];
+        iovecs[i].iov_len = queued[i].size();
+        memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &destination;
+        messages[i].msg_hdr.msg_namelen = sizeof(destination);
+    }
+
+    size_t sent = 0;
+    while (sent < queued.size())
+    {
+        int n = sendmmsg(sockfd, messages.data() + sent, queued.size() - sent, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "Failed to send datagrams: " << strerror(errno) << endl;
+            queued.erase(queued.begin(), queued.begin() + sent);
+            return false;
+        }
+        sent += n;
+    }
+    datagrams_sent += sent;
+    queued.clear();
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef RECORD_SENDER_H
+#define RECORD_SENDER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <netinet/in.h>
+#include "record.h"
+
+struct SenderOptions
+{
+    size_t max_datagram = 1400; // Target payload size; keeps a batch inside one Ethernet frame
+    int max_delay_ms = 5;       // Longest a record may wait for its batch to fill
+    bool framed = false;        // Length-prefixed frames instead of newline-delimited JSON
+    size_t max_queued = 64;     // Full datagrams sent together with one sendmmsg
+};
+
+// Client-side counterpart of the server's envelope parsing. Coalesces records
+// into datagrams of up to max_datagram bytes, and sends a partial batch once
+// its oldest record has waited max_delay_ms. Records that do not fit in one
+// datagram on their own are split with the UFRG fragment header.
+//
+// Not thread-safe, and there is no background thread: the latency budget is
+// checked on every send() and poll(), so an idle caller should call poll()
+// now and then (or flush() when done).
+class RecordSender
+{
+public:
+    explicit RecordSender(const SenderOptions &options = SenderOptions());
+    ~RecordSender();
+
+    RecordSender(const RecordSender &) = delete;
+    RecordSender &operator=(const RecordSender &) = delete;
+
+    bool open(const std::string &host, uint16_t port);
+
+    // Queues one JSON object (no trailing newline). Returns false if sending
+    // queued datagrams failed, or if the record is too large to send even in
+    // 65535 fragments; such a record is not queued or counted.
+    bool send(std::string_view record_json);
+    bool send(const Record &record);
+
+    // Sends the partial batch if it is older than the latency budget
+    bool poll();
+
+    // Sends everything queued
+    bool flush();
+
+    uint64_t datagramsSent() const { return datagrams_sent; }
+    uint64_t recordsSent() const { return records_sent; }
+
+private:
+    SenderOptions options;
+    int sockfd;
+    sockaddr_in destination;
+
+    std::string batch; // Datagram being filled
+    size_t batch_records;
+    std::chrono::steady_clock::time_point batch_started;
+
+    std::vector<std::string> queued; // Complete datagrams waiting for sendmmsg
+    std::string scratch;
+    uint32_t next_message_id;
+
+    uint64_t datagrams_sent;
+    uint64_t records_sent;
+
+    void closeBatch();
+    bool queueFragments(std::string_view record_json);
+    bool sendQueued();
+};
+
+#endif
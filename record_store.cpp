@@ -0,0 +1,305 @@
+#include "record_store.h"
+
+#include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+static uint64_t now_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+bool parse_overload_policy(const string &name, OverloadPolicy &policy)
+{
+    if (name == "drop-newest")
+    {
+        policy = OverloadPolicy::DropNewest;
+    }
+    else if (name == "drop-oldest")
+    {
+        policy = OverloadPolicy::DropOldest;
+    }
+    else if (name == "sample")
+    {
+        policy = OverloadPolicy::Sample;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+RecordStore::Chunk::~Chunk()
+{
+    if (!path.empty())
+    {
+        file.reset(); // Unmapped before the file goes
+        unlink(path.c_str());
+    }
+}
+
+void RecordStore::Snapshot::forEach(Arena &arena, const function<void(const Record &)> &visit) const
+{
+    size_t remaining = count;
+    for (size_t index = 0; directory && index < directory->chunks.size() && remaining > 0; ++index)
+    {
+        const Chunk &chunk = *directory->chunks[index];
+        const size_t n = index + 1 == directory->chunks.size() ? remaining : min(chunk.size, remaining);
+        remaining -= n;
+        if (chunk.records)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                visit(chunk.records[i]);
+            }
+        }
+        else if (chunk.file)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                Arena::Mark mark = arena.mark();
+                Record record;
+                chunk.file->read(i, arena, record);
+                visit(record);
+                arena.rewind(mark);
+            }
+        }
+    }
+}
+
+RecordStore::RecordStore(int shard, const StoreOptions &options)
+    : shard(shard), options(options), directory(make_shared<Directory>()), count(0), chunk_records(CHUNK_RECORDS),
+      chunk_bytes(options.memory_limit / 8)
+{
+    if (chunk_bytes > 0)
+    {
+        // Until a chunk has been filled, guess half for the records, half for their text
+        chunk_records = min(CHUNK_RECORDS, max<size_t>(64, chunk_bytes / 2 / sizeof(Record)));
+    }
+
+    if (options.spill_dir.empty())
+    {
+        return;
+    }
+    // Whatever an earlier run spilled is in its WAL too
+    error_code ec;
+    filesystem::create_directories(options.spill_dir, ec);
+    const string prefix = "shard-" + to_string(shard) + "-";
+    for (const auto &entry : filesystem::directory_iterator(options.spill_dir, ec))
+    {
+        const string name = entry.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 && entry.path().extension() == ".urf")
+        {
+            filesystem::remove(entry.path(), ec);
+        }
+    }
+    if (ec)
+    {
+        cerr << "Failed to prepare spill directory " << options.spill_dir << ": " << ec.message() << endl;
+    }
+}
+
+RecordStore::Snapshot RecordStore::snapshot() const
+{
+    Snapshot snapshot;
+    lock_guard<mutex> lock(directory_mutex);
+    snapshot.directory = directory;
+    snapshot.count = count.load(memory_order_acquire);
+    return snapshot;
+}
+
+size_t RecordStore::chunkBytes(const Chunk &chunk)
+{
+    return (chunk.records ? chunk.capacity * sizeof(Record) : 0) + chunk.arena.bytesReserved();
+}
+
+size_t RecordStore::memoryBytes() const
+{
+    return sealed_bytes + (open ? chunkBytes(*open) : 0);
+}
+
+bool RecordStore::openFull() const
+{
+    return !open || open_size == open->capacity || (chunk_bytes > 0 && open_size > 0 && chunkBytes(*open) >= chunk_bytes);
+}
+
+Arena &RecordStore::arena()
+{
+    if (openFull())
+    {
+        openChunk();
+    }
+    pending = open->arena.mark();
+    return open->arena;
+}
+
+// The full chunk stops changing, so its memory is counted once here
+void RecordStore::openChunk()
+{
+    if (open)
+    {
+        open->size = open_size; // Published with the directory below
+        sealed_bytes += chunkBytes(*open);
+        if (chunk_bytes > 0 && open_size > 0)
+        {
+            // Sized after the last chunk, so little of the array goes unused
+            // when records carry a lot of text
+            size_t per_record = sizeof(Record) + open->arena.bytesUsed() / open_size;
+            chunk_records = min(CHUNK_RECORDS, max<size_t>(64, chunk_bytes / per_record));
+        }
+    }
+    open = make_shared<Chunk>();
+    open->records.reset(new Record[chunk_records]);
+    open->capacity = chunk_records;
+    open_size = 0;
+    pending = open->arena.mark();
+
+    auto grown = make_shared<Directory>(*directory);
+    grown->chunks.push_back(open);
+    lock_guard<mutex> lock(directory_mutex);
+    directory = grown;
+}
+
+// Puts the spilled or dropped stand-in for a full chunk in its place
+void RecordStore::replaceChunk(size_t index, shared_ptr<Chunk> chunk)
+{
+    auto changed = make_shared<Directory>(*directory);
+    const Chunk &old = *changed->chunks[index];
+    sealed_bytes -= chunkBytes(old);
+    chunk->size = old.size;
+    chunk->newest_ns = old.newest_ns;
+    if (chunk->file)
+    {
+        changed->spilled++;
+    }
+    else
+    {
+        changed->dropped += old.size;
+    }
+    // Readers still holding the old directory keep the old chunk alive
+    changed->chunks[index] = move(chunk);
+    lock_guard<mutex> lock(directory_mutex);
+    directory = changed;
+}
+
+// Writes the oldest full chunk still in memory to a record file and maps it
+// back in its place. Returns false if there is none or spilling is off or failed.
+bool RecordStore::spillOldest()
+{
+    const size_t chunk_count = directory->chunks.size();
+    if (options.spill_dir.empty() || resident_begin + 1 >= chunk_count || spill_blocked >= chunk_count)
+    {
+        return false;
+    }
+
+    const Chunk &resident = *directory->chunks[resident_begin];
+    auto spilled = make_shared<Chunk>();
+    spilled->path = (filesystem::path(options.spill_dir) /
+                     ("shard-" + to_string(shard) + "-" + to_string(resident_begin) + ".urf"))
+                        .string();
+    try
+    {
+        RecordFileWriter writer(spilled->path);
+        for (size_t i = 0; i < resident.size; ++i)
+        {
+            writer.append(resident.records[i]);
+        }
+        writer.finish();
+        spilled->file.reset(new RecordFile(spilled->path));
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Failed to spill records: " << e.what() << endl;
+        stats.spill_failures.fetch_add(1, memory_order_relaxed);
+        spill_blocked = chunk_count; // Retried once another chunk is full
+        return false;                // The partial file goes with spilled
+    }
+
+    error_code ec;
+    stats.spilled_bytes.fetch_add(filesystem::file_size(spilled->path, ec), memory_order_relaxed);
+    stats.spilled_records.fetch_add(resident.size, memory_order_relaxed);
+    replaceChunk(resident_begin++, move(spilled));
+    return true;
+}
+
+bool RecordStore::dropOldest()
+{
+    if (resident_begin + 1 >= directory->chunks.size())
+    {
+        return false;
+    }
+    stats.dropped_oldest.fetch_add(directory->chunks[resident_begin]->size, memory_order_relaxed);
+    replaceChunk(resident_begin++, make_shared<Chunk>());
+    return true;
+}
+
+// At the limit with nothing left to spill: whether the policy lets the
+// record in, after making what room it can
+bool RecordStore::admitOverloaded()
+{
+    switch (options.policy)
+    {
+    case OverloadPolicy::DropNewest:
+        stats.dropped_newest.fetch_add(1, memory_order_relaxed);
+        return false;
+    case OverloadPolicy::Sample:
+        if (++sample_count < max<uint32_t>(options.sample_every, 1))
+        {
+            stats.sampled_out.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        sample_count = 0;
+        break;
+    case OverloadPolicy::DropOldest:
+        break;
+    }
+    while (overLimit() && dropOldest())
+    {
+    }
+    return true;
+}
+
+bool RecordStore::push_back(const Record &record)
+{
+    if (!open || open_size == open->capacity)
+    {
+        openChunk(); // Text is elsewhere; arena() was not called
+    }
+
+    if (options.spill_after_s > 0)
+    {
+        // Time-based: full chunks nobody has added to for a while are cold
+        const uint64_t now = record.received_ns != 0 ? record.received_ns : now_ns();
+        const uint64_t age = uint64_t(options.spill_after_s) * 1000000000;
+        while (resident_begin + 1 < directory->chunks.size() &&
+               directory->chunks[resident_begin]->newest_ns + age < now && spillOldest())
+        {
+        }
+    }
+    if (overLimit())
+    {
+        while (overLimit() && spillOldest())
+        {
+        }
+        if (overLimit() && !admitOverloaded())
+        {
+            open->arena.rewind(pending);
+            stats.memory_bytes.store(memoryBytes(), memory_order_relaxed);
+            return false;
+        }
+    }
+
+    open->records[open_size++] = record;
+    open->newest_ns = max(open->newest_ns, record.received_ns);
+    count.store(count.load(memory_order_relaxed) + 1, memory_order_release);
+    stats.memory_bytes.store(memoryBytes(), memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,159 @@
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "record.h"
+#include "record_file.h"
+
+// What a store at its memory limit does with new records once nothing more
+// can be spilled
+enum class OverloadPolicy : uint8_t
+{
+    DropNewest, // Refuse them
+    DropOldest, // Discard the oldest chunk in memory to make room
+    Sample      // Keep one in sample_every, discarding the oldest chunk for it
+};
+
+// "drop-newest", "drop-oldest" or "sample"
+bool parse_overload_policy(const std::string &name, OverloadPolicy &policy);
+
+struct StoreOptions
+{
+    size_t memory_limit = 0; // Bytes of records and their text held in memory; 0 is unlimited
+    std::string spill_dir;   // Full chunks over the limit go to record files here; empty disables
+    int spill_after_s = 0;   // Also spill full chunks whose newest record is this old; 0 disables
+    OverloadPolicy policy = OverloadPolicy::DropNewest;
+    uint32_t sample_every = 10;
+};
+
+struct StoreCounters
+{
+    std::atomic<uint64_t> memory_bytes{0};    // Held in memory now
+    std::atomic<uint64_t> dropped_newest{0};  // Refused at the limit
+    std::atomic<uint64_t> dropped_oldest{0};  // Discarded with their chunk to make room
+    std::atomic<uint64_t> sampled_out{0};     // Skipped by the sample policy
+    std::atomic<uint64_t> spilled_records{0}; // Moved to spill files
+    std::atomic<uint64_t> spilled_bytes{0};   // Written to spill files
+    std::atomic<uint64_t> spill_failures{0};
+};
+
+// Append-only record storage that other threads can read while it grows.
+// Records live in chunks that never move, each with an arena for the
+// records' text, so a snapshot is just a reference to the chunk directory
+// plus the number of records published at that moment: taking one is O(1),
+// and the writer never waits for readers. The directory is copied whenever
+// it changes; readers keep the copy they have, and with it the chunks.
+//
+// Memory is bounded by memory_limit. A chunk is full at CHUNK_RECORDS records
+// or an eighth of the limit, whichever comes first. Over the limit, the
+// oldest full chunks in memory are written to record files in spill_dir
+// (mapped back for reading); without a spill directory, or when spilling
+// fails, the overload policy decides. The chunk being filled always stays.
+//
+// One writer (the shard's parse thread); snapshots may be taken from any
+// thread but must not outlive the store.
+class RecordStore
+{
+public:
+    static const size_t CHUNK_RECORDS = 4096;
+
+    // In memory, spilled (records null, file set) or dropped (neither)
+    struct Chunk
+    {
+        std::unique_ptr<Record[]> records;
+        size_t capacity = 0;
+        size_t size = 0;                  // Set once full; the last chunk's readers go by their count
+        Arena arena;                      // Text of the records
+        std::unique_ptr<RecordFile> file;
+        std::string path;                 // Of the spill file, removed with the chunk
+        uint64_t newest_ns = 0;
+
+        ~Chunk();
+    };
+
+    struct Directory
+    {
+        std::vector<std::shared_ptr<const Chunk>> chunks;
+        uint64_t dropped = 0; // Records in dropped chunks
+        size_t spilled = 0;   // Chunks on disk
+    };
+
+    class Snapshot
+    {
+    public:
+        size_t size() const { return count - (directory ? directory->dropped : 0); }
+
+        // True if some records have to be read back from disk
+        bool spilled() const { return directory && directory->spilled > 0; }
+
+        // Calls visit for every record, oldest first. Records in memory stay
+        // valid while the snapshot lives; spilled ones are decoded into arena
+        // and only valid during their call. Throws runtime_error if a spill
+        // file is corrupt.
+        void forEach(Arena &arena, const std::function<void(const Record &)> &visit) const;
+
+    private:
+        friend class RecordStore;
+        std::shared_ptr<const Directory> directory;
+        size_t count = 0; // Published records, dropped ones included
+    };
+
+    // Spill files are named after shard; stale ones from an earlier run are removed
+    explicit RecordStore(int shard = 0, const StoreOptions &options = StoreOptions());
+
+    RecordStore(const RecordStore &) = delete;
+    RecordStore &operator=(const RecordStore &) = delete;
+
+    // Writer only. The arena the next record's text belongs in; call it
+    // before parsing each record, so the text goes with the record's chunk.
+    Arena &arena();
+
+    // Writer only. Returns false if the overload policy refused the record
+    // (its text is then released as well).
+    bool push_back(const Record &record);
+
+    size_t size() const { return snapshot().size(); }
+
+    Snapshot snapshot() const;
+
+    const StoreCounters &counters() const { return stats; }
+
+private:
+    int shard;
+    StoreOptions options;
+    std::shared_ptr<const Directory> directory;
+    mutable std::mutex directory_mutex; // Guards swapping directory
+    std::atomic<size_t> count;
+
+    size_t chunk_records; // Capacity of new chunks
+    size_t chunk_bytes;   // A chunk using this much is full; 0 is no limit
+
+    // Writer state
+    std::shared_ptr<Chunk> open;  // Chunk being filled; the last in the directory
+    size_t open_size = 0;         // Records in it
+    Arena::Mark pending;          // Arena position before the record being parsed
+    size_t resident_begin = 0;    // Oldest full chunk still in memory
+    size_t sealed_bytes = 0;      // Memory of the full chunks still in memory
+    size_t spill_blocked = 0;     // After a failure, no spilling until the directory grows past this
+    uint32_t sample_count = 0;
+    StoreCounters stats;
+
+    static size_t chunkBytes(const Chunk &chunk);
+    size_t memoryBytes() const;
+    bool overLimit() const { return options.memory_limit > 0 && memoryBytes() > options.memory_limit; }
+    bool openFull() const;
+    void openChunk();
+    void replaceChunk(size_t index, std::shared_ptr<Chunk> chunk);
+    bool spillOldest();
+    bool dropOldest();
+    bool admitOverloaded();
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "report_scheduler.h"
+
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include "pdf_document.h"
+
+using namespace std;
+
+ReportScheduler::ReportScheduler(const vector<unique_ptr<IngestWorker>> &workers, const ReportOptions &options)
+    : workers(workers), options(options), requested(false), stopping(false), reported_records(0), failed_reports(0)
+{
+}
+
+ReportScheduler::~ReportScheduler()
+{
+    stop();
+}
+
+void ReportScheduler::start()
+{
+    thread = std::thread([this]
+                         { run(); });
+}
+
+void ReportScheduler::request()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        requested = true;
+    }
+    wakeup.notify_one();
+}
+
+void ReportScheduler::stop()
+{
+    if (thread.joinable())
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        thread.join();
+    }
+}
+
+uint64_t ReportScheduler::storedRecords() const
+{
+    uint64_t total = 0;
+    for (const auto &worker : workers)
+    {
+        total += worker->counters().stored.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+void ReportScheduler::run()
+{
+    // The record count is polled, which is cheap next to rendering
+    const auto poll_interval = chrono::milliseconds(200);
+    auto last_report = chrono::steady_clock::now();
+
+    while (true)
+    {
+        bool forced;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, poll_interval, [this]
+                            { return requested || stopping; });
+            if (stopping)
+            {
+                return;
+            }
+            forced = requested;
+            requested = false;
+        }
+
+        uint64_t fresh = storedRecords() - reported_records;
+        bool due = fresh > 0 &&
+                   ((options.interval_s > 0 && chrono::steady_clock::now() - last_report >= chrono::seconds(options.interval_s)) ||
+                    (options.every_records > 0 && fresh >= options.every_records));
+        if (forced || due)
+        {
+            // One thread, so rendering never competes with the workers for every core
+            generate(1);
+            last_report = chrono::steady_clock::now();
+        }
+    }
+}
+
+bool ReportScheduler::generate(size_t jobs)
+{
+    lock_guard<std::mutex> lock(render_mutex);
+    auto started = chrono::steady_clock::now();
+
+    // Each snapshot is a consistent prefix of its worker's records; workers
+    // keep appending past it while we render. Held until the report is
+    // written, so the chunks they refer to stay put.
+    vector<RecordStore::Snapshot> snapshots;
+    uint64_t stored = storedRecords();
+    size_t record_count = 0;
+    bool spilled = false;
+    for (const auto &worker : workers)
+    {
+        snapshots.push_back(worker->snapshot());
+        record_count += snapshots.back().size();
+        spilled = spilled || snapshots.back().spilled();
+    }
+
+    // Written beside the output so the final rename stays on one filesystem
+    filesystem::path output(options.path);
+    filesystem::path partial = output;
+    partial.replace_filename("." + output.stem().string() + ".partial" + output.extension().string());
+
+    RenderOptions render;
+    render.jobs = jobs;
+    render.summary = options.summary;
+    try
+    {
+        if (spilled)
+        {
+            // Spilled records are read back one at a time, twice, instead
+            // of all being brought back into memory
+            streamReport([&](const function<void(const Record &)> &visit)
+                         {
+                Arena arena;
+                for (const auto &snapshot : snapshots)
+                {
+                    snapshot.forEach(arena, visit);
+                } },
+                         partial.string(), render);
+        }
+        else
+        {
+            vector<Record> records;
+            records.reserve(record_count);
+            Arena unused; // Nothing is decoded
+            for (const auto &snapshot : snapshots)
+            {
+                snapshot.forEach(unused, [&](const Record &record)
+                                 { records.push_back(record); });
+            }
+            generateReport(records, partial.string(), render);
+        }
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Failed to generate report: " << e.what() << endl;
+        remove(partial.string().c_str());
+        failed_reports.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    if (rename(partial.string().c_str(), options.path.c_str()) != 0)
+    {
+        cerr << "Failed to rename " << partial.string() << " to " << options.path << ": " << strerror(errno) << endl;
+        remove(partial.string().c_str());
+        failed_reports.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    reported_records = max(reported_records, stored);
+    render_times.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count());
+
+    // One write, so the line is not interleaved with the log writer's output
+    string line = "Report written to " + options.path + " (" + to_string(record_count) + " records)\n";
+    cout << line << flush;
+    return true;
+}
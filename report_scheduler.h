@@ -0,0 +1,72 @@
+#ifndef REPORT_SCHEDULER_H
+#define REPORT_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ingest_worker.h"
+#include "latency_histogram.h"
+#include "report_summary.h"
+
+struct ReportOptions
+{
+    std::string path = "output.pdf";
+    int interval_s = 0;         // Report this often while new records arrive; 0 disables
+    uint64_t every_records = 0; // Report after this many new records; 0 disables
+    SummaryMode summary = SummaryMode::Off;
+};
+
+// Produces reports while the workers keep ingesting. A background thread
+// renders a report when asked to (request(), e.g. on SIGUSR1), when the
+// interval has passed or when enough records have arrived since the last one.
+// Each report is rendered from snapshots of the workers' stores into a
+// temporary file next to the output and renamed over it once complete, so
+// readers only ever see whole reports.
+class ReportScheduler
+{
+public:
+    ReportScheduler(const std::vector<std::unique_ptr<IngestWorker>> &workers, const ReportOptions &options);
+    ~ReportScheduler();
+
+    ReportScheduler(const ReportScheduler &) = delete;
+    ReportScheduler &operator=(const ReportScheduler &) = delete;
+
+    void start();
+
+    // Asks for a report as soon as possible. Thread-safe.
+    void request();
+
+    // Lets a report in progress finish, then joins the thread
+    void stop();
+
+    // Snapshots the workers and writes a report now, using up to jobs threads
+    // (0 means one per core). Reports never overlap. Returns false on failure.
+    bool generate(size_t jobs);
+
+    // Wall time of every report written so far, nanoseconds; readable at any time
+    const SharedLatencyHistogram &renderTimes() const { return render_times; }
+    uint64_t failures() const { return failed_reports.load(std::memory_order_relaxed); }
+
+private:
+    const std::vector<std::unique_ptr<IngestWorker>> &workers;
+    ReportOptions options;
+    std::thread thread;
+    std::mutex mutex; // Guards the flags below
+    std::condition_variable wakeup;
+    bool requested;
+    bool stopping;
+    std::mutex render_mutex; // Held while a report is written
+    uint64_t reported_records;
+    SharedLatencyHistogram render_times; // Written under render_mutex
+    std::atomic<uint64_t> failed_reports;
+
+    void run();
+    uint64_t storedRecords() const;
+};
+
+#endif
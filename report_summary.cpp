@@ -0,0 +1,262 @@
+#include "report_summary.h"
+
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+
+bool parse_summary_mode(const string &name, SummaryMode &mode)
+{
+    if (name == "off")
+    {
+        mode = SummaryMode::Off;
+    }
+    else if (name == "first")
+    {
+        mode = SummaryMode::First;
+    }
+    else if (name == "only")
+    {
+        mode = SummaryMode::Only;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool equals_lower(string_view text, const char *lower)
+{
+    size_t i = 0;
+    for (; i < text.size() && lower[i] != '\0'; ++i)
+    {
+        if (tolower(static_cast<unsigned char>(text[i])) != lower[i])
+        {
+            return false;
+        }
+    }
+    return i == text.size() && lower[i] == '\0';
+}
+
+Outcome classify_status(string_view status)
+{
+    for (const char *passed : {"pass", "passed", "ok", "success", "succeeded"})
+    {
+        if (equals_lower(status, passed))
+        {
+            return Outcome::Passed;
+        }
+    }
+    for (const char *failed : {"fail", "failed", "failure", "error"})
+    {
+        if (equals_lower(status, failed))
+        {
+            return Outcome::Failed;
+        }
+    }
+    return Outcome::Other;
+}
+
+static string_view string_field(const Record &record, Record::Field field)
+{
+    const RecordField &value = record[field];
+    return value.kind == FieldKind::String ? value.str() : string_view();
+}
+
+void RecordColumns::resize(size_t count)
+{
+    status.resize(count);
+    command.resize(count);
+    received_ns.resize(count);
+}
+
+void RecordColumns::set(size_t i, const Record &record)
+{
+    string_view canonical;
+    status[i] = statuses.intern(string_field(record, Record::STATUS), canonical);
+    command[i] = commands.intern(string_field(record, Record::CMD_NAME), canonical);
+    received_ns[i] = record.received_ns;
+}
+
+void RecordColumns::push_back(const Record &record)
+{
+    resize(size() + 1);
+    set(size() - 1, record);
+}
+
+// Histogram of keys below counts.size(). With few distinct keys, runs of
+// equal keys are common, so four interleaved tables keep consecutive
+// increments independent instead of each waiting on the previous one.
+static void count_keys(const vector<uint32_t> &keys, vector<uint64_t> &counts)
+{
+    const size_t distinct = counts.size();
+    const size_t n = keys.size();
+    if (distinct > 65536)
+    {
+        for (uint32_t key : keys)
+        {
+            counts[key]++;
+        }
+        return;
+    }
+
+    vector<uint64_t> partial(3 * distinct, 0);
+    uint64_t *c0 = counts.data();
+    uint64_t *c1 = partial.data();
+    uint64_t *c2 = c1 + distinct;
+    uint64_t *c3 = c2 + distinct;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        c0[keys[i]]++;
+        c1[keys[i + 1]]++;
+        c2[keys[i + 2]]++;
+        c3[keys[i + 3]]++;
+    }
+    for (; i < n; ++i)
+    {
+        c0[keys[i]]++;
+    }
+    for (size_t k = 0; k < distinct; ++k)
+    {
+        c0[k] += c1[k] + c2[k] + c3[k];
+    }
+}
+
+// The top rows by order (ties by value, so the result does not depend on
+// the order ids were handed out in), skipping rows with no records
+template <typename Less>
+static vector<SummaryCount> top_rows(vector<SummaryCount> rows, size_t top, Less less)
+{
+    rows.erase(remove_if(rows.begin(), rows.end(), [](const SummaryCount &row)
+                         { return row.records == 0; }),
+               rows.end());
+    auto order = [&](const SummaryCount &a, const SummaryCount &b)
+    { return less(b, a) || (!less(a, b) && a.value < b.value); };
+    if (rows.size() > top)
+    {
+        partial_sort(rows.begin(), rows.begin() + top, rows.end(), order);
+        rows.resize(top);
+    }
+    else
+    {
+        sort(rows.begin(), rows.end(), order);
+    }
+    return rows;
+}
+
+// Every pass below is a straight loop over flat arrays without branches in
+// the body (conditions are selects), so the compiler can vectorize them; the
+// histograms then only do one increment per record.
+ReportSummary summarize(const RecordColumns &columns, const SummaryOptions &options)
+{
+    ReportSummary summary;
+    const size_t n = columns.size();
+    const size_t status_count = columns.statuses.size();
+    const size_t command_count = columns.commands.size();
+    summary.records = n;
+    summary.statuses = status_count;
+    summary.commands = command_count;
+    if (n == 0)
+    {
+        return summary;
+    }
+
+    // Outcome of each record, looked up through its status id
+    vector<uint8_t> outcome_of(status_count);
+    for (uint32_t id = 0; id < status_count; ++id)
+    {
+        outcome_of[id] = static_cast<uint8_t>(classify_status(columns.statuses.text(id)));
+    }
+    vector<uint8_t> outcome(n);
+    const uint32_t *status = columns.status.data();
+    for (size_t i = 0; i < n; ++i)
+    {
+        outcome[i] = outcome_of[status[i]];
+    }
+
+    // By status
+    vector<uint64_t> per_status(status_count, 0);
+    count_keys(columns.status, per_status);
+    vector<SummaryCount> rows(status_count);
+    for (uint32_t id = 0; id < status_count; ++id)
+    {
+        rows[id].value = string(columns.statuses.text(id));
+        rows[id].records = per_status[id];
+        rows[id].failed = outcome_of[id] == static_cast<uint8_t>(Outcome::Failed) ? per_status[id] : 0;
+        summary.passed += outcome_of[id] == static_cast<uint8_t>(Outcome::Passed) ? per_status[id] : 0;
+        summary.failed += rows[id].failed;
+    }
+    summary.by_status = top_rows(move(rows), options.top, [](const SummaryCount &a, const SummaryCount &b)
+                                 { return a.records < b.records; });
+
+    // By command: key = command * 2 + failed
+    vector<uint32_t> keys(n);
+    const uint32_t *command = columns.command.data();
+    for (size_t i = 0; i < n; ++i)
+    {
+        keys[i] = command[i] * 2 + (outcome[i] == static_cast<uint8_t>(Outcome::Failed));
+    }
+    vector<uint64_t> per_command(2 * command_count, 0);
+    count_keys(keys, per_command);
+    rows.assign(command_count, SummaryCount());
+    for (uint32_t id = 0; id < command_count; ++id)
+    {
+        rows[id].value = string(columns.commands.text(id));
+        rows[id].records = per_command[2 * id] + per_command[2 * id + 1];
+        rows[id].failed = per_command[2 * id + 1];
+    }
+    summary.by_command = top_rows(rows, options.top, [](const SummaryCount &a, const SummaryCount &b)
+                                  { return a.records < b.records; });
+    rows.erase(remove_if(rows.begin(), rows.end(), [](const SummaryCount &row)
+                         { return row.failed == 0; }),
+               rows.end());
+    summary.failing = top_rows(move(rows), options.top, [](const SummaryCount &a, const SummaryCount &b)
+                               { return a.failed < b.failed; });
+
+    // Timeline: the earliest and latest receive time, then
+    // key = bucket * 3 + outcome, with untimed records in a bucket of their own
+    const uint64_t *received = columns.received_ns.data();
+    uint64_t earliest = UINT64_MAX;
+    uint64_t latest = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        earliest = min(earliest, received[i] != 0 ? received[i] : UINT64_MAX);
+        latest = max(latest, received[i]);
+    }
+    if (latest == 0 || options.time_buckets == 0)
+    {
+        summary.untimed = latest == 0 ? n : 0;
+        return summary;
+    }
+
+    // Power-of-two bucket widths, so a bucket index is a subtraction and a
+    // shift rather than a 64-bit division per record
+    const uint64_t span = latest - earliest;
+    unsigned shift = 0;
+    while ((span >> shift) >= options.time_buckets)
+    {
+        shift++;
+    }
+    const uint32_t buckets = static_cast<uint32_t>(span >> shift) + 1;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t bucket = received[i] != 0 ? static_cast<uint32_t>((received[i] - earliest) >> shift) : buckets;
+        keys[i] = bucket * 3 + outcome[i];
+    }
+    vector<uint64_t> per_bucket(3 * (buckets + 1), 0);
+    count_keys(keys, per_bucket);
+    for (uint32_t b = 0; b < buckets; ++b)
+    {
+        SummaryBucket bucket;
+        bucket.from_ns = earliest + (uint64_t(b) << shift);
+        bucket.to_ns = bucket.from_ns + (uint64_t(1) << shift);
+        bucket.passed = per_bucket[3 * b + static_cast<uint8_t>(Outcome::Passed)];
+        bucket.failed = per_bucket[3 * b + static_cast<uint8_t>(Outcome::Failed)];
+        bucket.other = per_bucket[3 * b + static_cast<uint8_t>(Outcome::Other)];
+        summary.timeline.push_back(bucket);
+    }
+    summary.untimed = per_bucket[3 * buckets] + per_bucket[3 * buckets + 1] + per_bucket[3 * buckets + 2];
+    return summary;
+}
@@ -0,0 +1,98 @@
+#ifndef REPORT_SUMMARY_H
+#define REPORT_SUMMARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "record.h"
+#include "string_interner.h"
+
+enum class SummaryMode : uint8_t
+{
+    Off,   // Entries only
+    First, // Summary section, then the entries
+    Only   // Summary section only
+};
+
+// "off", "first" or "only"
+bool parse_summary_mode(const std::string &name, SummaryMode &mode);
+
+struct SummaryOptions
+{
+    size_t time_buckets = 24; // At most this many rows in the timeline
+    size_t top = 10;          // Rows in the status, command and failing command tables
+};
+
+// How a status value counts: "pass", "passed", "ok", "success" and
+// "succeeded" pass, "fail", "failed", "failure" and "error" fail (in any
+// case), anything else is other
+enum class Outcome : uint8_t
+{
+    Passed,
+    Failed,
+    Other
+};
+
+Outcome classify_status(std::string_view status);
+
+// Struct-of-arrays view of the fields the summary looks at: per record the
+// dense id of its status and command name (missing ones map to "") and its
+// receive time (0 when unknown). Scanning three flat arrays of integers is
+// what keeps a summary of tens of millions of records fast; the strings are
+// only looked at once per distinct value.
+class RecordColumns
+{
+public:
+    std::vector<uint32_t> status;
+    std::vector<uint32_t> command;
+    std::vector<uint64_t> received_ns;
+    StringInterner statuses; // Text by id
+    StringInterner commands;
+
+    size_t size() const { return status.size(); }
+
+    // Sizes the columns for count records, to be filled by set()
+    void resize(size_t count);
+
+    // Fills row i; threads may fill distinct rows at once
+    void set(size_t i, const Record &record);
+
+    // Single thread
+    void push_back(const Record &record);
+};
+
+struct SummaryCount
+{
+    std::string value;
+    uint64_t records = 0;
+    uint64_t failed = 0;
+};
+
+struct SummaryBucket
+{
+    uint64_t from_ns = 0; // Receive times in [from_ns, to_ns)
+    uint64_t to_ns = 0;
+    uint64_t passed = 0;
+    uint64_t failed = 0;
+    uint64_t other = 0;
+};
+
+struct ReportSummary
+{
+    uint64_t records = 0;
+    uint64_t passed = 0;
+    uint64_t failed = 0;
+    uint64_t untimed = 0;                 // Records without a receive time; not in the timeline
+    std::vector<SummaryCount> by_status;  // Most records first, top only
+    std::vector<SummaryCount> by_command; // Likewise
+    std::vector<SummaryCount> failing;    // Commands with the most failures first, top only
+    size_t statuses = 0;                  // Distinct values, including those past the top
+    size_t commands = 0;
+    std::vector<SummaryBucket> timeline;  // Equal-width buckets from the earliest receive time on
+};
+
+ReportSummary summarize(const RecordColumns &columns, const SummaryOptions &options = SummaryOptions());
+
+#endif
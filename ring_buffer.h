@@ -0,0 +1,257 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Bounded lock-free queues connecting the ingestion pipeline stages. Neither
+// queue ever blocks the producer: a full queue makes the push fail, and the
+// caller applies its own drop policy (and counts the drop).
+
+inline size_t round_up_pow2(size_t n)
+{
+    size_t capacity = 1;
+    while (capacity < n)
+    {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Single-producer/single-consumer ring. Slots are written and read in place
+// (claim/publish, front/pop) so large slots are never copied twice.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : mask(round_up_pow2(capacity) - 1), slots(mask + 1), head(0), tail(0), cached_head(0), cached_tail(0)
+    {
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // Producer: returns the next free slot, or nullptr when the ring is full
+    T *claim()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+            {
+                return nullptr;
+            }
+        }
+        return &slots[t & mask];
+    }
+
+    // Producer: makes the slot returned by claim() visible to the consumer
+    void publish()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool tryPush(T &&item)
+    {
+        T *slot = claim();
+        if (slot == nullptr)
+        {
+            return false;
+        }
+        *slot = std::move(item);
+        publish();
+        return true;
+    }
+
+    // Consumer: returns the oldest published slot, or nullptr when empty
+    T *front()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+            {
+                return nullptr;
+            }
+        }
+        return &slots[h & mask];
+    }
+
+    // Consumer: releases the slot returned by front()
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    // Safe from any thread: head is read first, so it never passes tail
+    size_t size() const
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    const size_t mask;
+    std::vector<T> slots;
+
+    // Producer and consumer indices live on separate cache lines, each next
+    // to the side's private copy of the other index
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) size_t cached_head; // producer's view of head
+    alignas(64) size_t cached_tail; // consumer's view of tail
+};
+
+// Multi-producer/single-consumer bounded queue (per-cell sequence numbers,
+// after Dmitry Vyukov's bounded MPMC queue).
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity)
+        : mask(round_up_pow2(capacity) - 1), cells(mask + 1), enqueue_pos(0), dequeue_pos(0)
+    {
+        for (size_t i = 0; i <= mask; ++i)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+
+    bool tryPush(T &&item)
+    {
+        Cell *cell;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Full
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &item)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Cell *cell = &cells[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if (seq != pos + 1)
+        {
+            return false; // Empty, or the producer has not finished writing
+        }
+        item = std::move(cell->data);
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool empty() const
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        return cells[pos & mask].sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    const size_t mask;
+    std::vector<Cell> cells;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+// Lets a consumer sleep on an eventfd when its queue runs dry. Producers only
+// pay for a syscall when the consumer is actually parked.
+class Doorbell
+{
+public:
+    Doorbell() : fd(eventfd(0, EFD_CLOEXEC)), waiting(false) {}
+    ~Doorbell() { close(fd); }
+
+    Doorbell(const Doorbell &) = delete;
+    Doorbell &operator=(const Doorbell &) = delete;
+
+    // Producer: call after publishing work
+    void ring()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false))
+        {
+            wake();
+        }
+    }
+
+    // Unconditional wake-up, used for shutdown
+    void wake()
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    // Consumer: sleeps unless has_work() turns true after announcing the wait.
+    // With timeout_ms >= 0, also returns once that much time has passed.
+    template <typename Pred>
+    void wait(Pred has_work, int timeout_ms = -1)
+    {
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!has_work())
+        {
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) > 0)
+            {
+                uint64_t value;
+                ssize_t ignored = read(fd, &value, sizeof(value));
+                (void)ignored;
+            }
+        }
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    int fd;
+    std::atomic<bool> waiting;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include "stats_server.h"
+
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const double QUANTILES[] = {0.5, 0.99, 0.999};
+
+StatsServer::StatsServer(const vector<unique_ptr<IngestWorker>> &workers, const ReportScheduler &reports,
+                         Logger &logger, const StatsOptions &options)
+    : workers(workers), reports(reports), logger(logger), options(options), listen_fd(-1), stop_fd(-1)
+{
+}
+
+StatsServer::~StatsServer()
+{
+    stop();
+}
+
+bool StatsServer::start()
+{
+    if (options.socket_path.empty() && options.summary_interval_s <= 0)
+    {
+        return true;
+    }
+
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd == -1)
+    {
+        cerr << "Failed to create eventfd: " << strerror(errno) << endl;
+        return false;
+    }
+
+    if (!options.socket_path.empty())
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (options.socket_path.size() >= sizeof(address.sun_path))
+        {
+            cerr << "Stats socket path is too long: " << options.socket_path << endl;
+            return false;
+        }
+        memcpy(address.sun_path, options.socket_path.c_str(), options.socket_path.size());
+
+        // A socket left behind by a previous run would make bind fail;
+        // anything else at that path is not ours to remove
+        struct stat existing;
+        if (lstat(options.socket_path.c_str(), &existing) == 0)
+        {
+            if (!S_ISSOCK(existing.st_mode))
+            {
+                cerr << "Failed to create stats socket: " << options.socket_path << " exists" << endl;
+                return false;
+            }
+            unlink(options.socket_path.c_str());
+        }
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1 || bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 ||
+            listen(listen_fd, 16) == -1)
+        {
+            cerr << "Failed to create stats socket " << options.socket_path << ": " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    thread = std::thread([this]
+                         { run(); });
+    return true;
+}
+
+void StatsServer::stop()
+{
+    if (thread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0)
+        {
+            cerr << "Failed to signal eventfd: " << strerror(errno) << endl;
+        }
+        thread.join();
+    }
+    if (listen_fd != -1)
+    {
+        close(listen_fd);
+        unlink(options.socket_path.c_str());
+        listen_fd = -1;
+    }
+    if (stop_fd != -1)
+    {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+}
+
+IngestTotals StatsServer::totals() const
+{
+    IngestTotals t;
+    for (const auto &worker : workers)
+    {
+        const WorkerCounters &c = worker->counters();
+        t.received += c.received.load(memory_order_relaxed);
+        t.bytes += c.bytes.load(memory_order_relaxed);
+        t.stored += c.stored.load(memory_order_relaxed);
+        t.parse_errors += c.parse_errors.load(memory_order_relaxed);
+        t.envelope_errors += c.envelope_errors.load(memory_order_relaxed);
+        t.truncated += c.truncated.load(memory_order_relaxed);
+        t.kernel_drops += worker->kernelDrops();
+        t.backlog_drops += worker->backlogDrops();
+        t.queue_depth += worker->queueDepth();
+        const StoreCounters &st = worker->storeCounters();
+        t.store_bytes += st.memory_bytes.load(memory_order_relaxed);
+        t.store_drops += st.dropped_newest.load(memory_order_relaxed) + st.dropped_oldest.load(memory_order_relaxed) +
+                         st.sampled_out.load(memory_order_relaxed);
+        t.spilled += st.spilled_records.load(memory_order_relaxed);
+        t.wal_drops += worker->walCounters().dropped_records.load(memory_order_relaxed);
+        t.ingest_latency.merge(c.ingest_latency.snapshot());
+    }
+    return t;
+}
+
+static void appendMetric(string &out, const char *name, const string &labels, double value)
+{
+    char number[32];
+    snprintf(number, sizeof(number), "%.15g", value);
+    out += name;
+    if (!labels.empty())
+    {
+        out += "{" + labels + "}";
+    }
+    out += " ";
+    out += number;
+    out += "\n";
+}
+
+static void appendQuantiles(string &out, const char *name, const string &labels, const LatencyHistogram &histogram,
+                            double scale)
+{
+    string prefix = labels.empty() ? "" : labels + ",";
+    for (double q : QUANTILES)
+    {
+        char quantile[16];
+        snprintf(quantile, sizeof(quantile), "%g", q);
+        appendMetric(out, name, prefix + "quantile=\"" + quantile + "\"", histogram.percentile(q) / scale);
+    }
+    appendMetric(out, (string(name) + "_max").c_str(), labels, histogram.max() / scale);
+    appendMetric(out, (string(name) + "_count").c_str(), labels, static_cast<double>(histogram.count()));
+}
+
+string StatsServer::metricsText() const
+{
+    string out;
+    for (const auto &worker : workers)
+    {
+        const WorkerCounters &c = worker->counters();
+        string labels = "worker=\"" + to_string(worker->id()) + "\"";
+        appendMetric(out, "udp_datagrams_received_total", labels, c.received.load(memory_order_relaxed));
+        appendMetric(out, "udp_bytes_received_total", labels, c.bytes.load(memory_order_relaxed));
+        appendMetric(out, "udp_records_stored_total", labels, c.stored.load(memory_order_relaxed));
+        appendMetric(out, "udp_parse_errors_total", labels, c.parse_errors.load(memory_order_relaxed));
+        for (size_t r = 1; r < REJECT_REASONS; ++r)
+        {
+            appendMetric(out, "udp_rejected_total",
+                         labels + ",reason=\"" + reject_reason_name(static_cast<RejectReason>(r)) + "\"",
+                         c.rejected[r].load(memory_order_relaxed));
+        }
+        appendMetric(out, "udp_envelope_errors_total", labels, c.envelope_errors.load(memory_order_relaxed));
+        appendMetric(out, "udp_truncated_total", labels, c.truncated.load(memory_order_relaxed));
+        appendMetric(out, "udp_kernel_drops_total", labels, worker->kernelDrops());
+        appendMetric(out, "udp_backlog_drops_total", labels, worker->backlogDrops());
+        appendMetric(out, "udp_queue_depth", labels, worker->queueDepth());
+        const StoreCounters &st = worker->storeCounters();
+        appendMetric(out, "udp_store_memory_bytes", labels, st.memory_bytes.load(memory_order_relaxed));
+        appendMetric(out, "udp_store_dropped_total", labels + ",reason=\"newest\"", st.dropped_newest.load(memory_order_relaxed));
+        appendMetric(out, "udp_store_dropped_total", labels + ",reason=\"oldest\"", st.dropped_oldest.load(memory_order_relaxed));
+        appendMetric(out, "udp_store_dropped_total", labels + ",reason=\"sampled\"", st.sampled_out.load(memory_order_relaxed));
+        appendMetric(out, "udp_store_spilled_records_total", labels, st.spilled_records.load(memory_order_relaxed));
+        appendMetric(out, "udp_store_spilled_bytes_total", labels, st.spilled_bytes.load(memory_order_relaxed));
+        appendMetric(out, "udp_store_spill_failures_total", labels, st.spill_failures.load(memory_order_relaxed));
+        const WalCounters &wc = worker->walCounters();
+        appendMetric(out, "udp_wal_write_errors_total", labels, wc.write_errors.load(memory_order_relaxed));
+        appendMetric(out, "udp_wal_dropped_total", labels, wc.dropped_records.load(memory_order_relaxed));
+        appendQuantiles(out, "udp_ingest_latency_us", labels, c.ingest_latency.snapshot(), 1e3);
+    }
+    appendMetric(out, "udp_log_dropped_total", "", logger.dropped());
+    appendMetric(out, "udp_log_suppressed_total", "", logger.suppressed());
+    appendQuantiles(out, "udp_report_render_ms", "", reports.renderTimes().snapshot(), 1e6);
+    appendMetric(out, "udp_report_failures_total", "", reports.failures());
+    return out;
+}
+
+string StatsServer::summaryLine(const IngestTotals &now, const IngestTotals &before, double seconds) const
+{
+    LatencyHistogram latency = now.ingest_latency;
+    latency.subtract(before.ingest_latency);
+
+    char line[512];
+    snprintf(line, sizeof(line),
+             "Stats: %.0f datagrams/s (%.2f MB/s), %.0f stored/s; drops: %llu kernel, %llu parser behind, "
+             "%llu store full, %llu WAL full; errors: %llu parse, %llu envelope, %llu truncated; queue %llu; store %.1f MB "
+             "(%llu spilled); receive to stored p50 %.0fus p99 %.0fus p999 %.0fus",
+             (now.received - before.received) / seconds, (now.bytes - before.bytes) / seconds / 1e6,
+             (now.stored - before.stored) / seconds,
+             static_cast<unsigned long long>(now.kernel_drops - before.kernel_drops),
+             static_cast<unsigned long long>(now.backlog_drops - before.backlog_drops),
+             static_cast<unsigned long long>(now.store_drops - before.store_drops),
+             static_cast<unsigned long long>(now.wal_drops - before.wal_drops),
+             static_cast<unsigned long long>(now.parse_errors - before.parse_errors),
+             static_cast<unsigned long long>(now.envelope_errors - before.envelope_errors),
+             static_cast<unsigned long long>(now.truncated - before.truncated),
+             static_cast<unsigned long long>(now.queue_depth), now.store_bytes / 1e6,
+             static_cast<unsigned long long>(now.spilled - before.spilled), latency.percentile(0.5) / 1e3,
+             latency.percentile(0.99) / 1e3, latency.percentile(0.999) / 1e3);
+    return line;
+}
+
+void StatsServer::run()
+{
+    const auto interval = chrono::seconds(options.summary_interval_s);
+    auto last_summary = chrono::steady_clock::now();
+    IngestTotals before = totals();
+
+    while (true)
+    {
+        int timeout = -1;
+        if (options.summary_interval_s > 0)
+        {
+            auto left = last_summary + interval - chrono::steady_clock::now();
+            timeout = static_cast<int>(max<int64_t>(0, chrono::duration_cast<chrono::milliseconds>(left).count()));
+        }
+
+        pollfd fds[2] = {{stop_fd, POLLIN, 0}, {listen_fd, POLLIN, 0}};
+        int ready = poll(fds, listen_fd != -1 ? 2 : 1, timeout);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "poll failed: " << strerror(errno) << endl;
+            return;
+        }
+        if (fds[0].revents != 0)
+        {
+            return;
+        }
+        if (listen_fd != -1 && (fds[1].revents & POLLIN))
+        {
+            serveClient();
+        }
+
+        auto now = chrono::steady_clock::now();
+        if (options.summary_interval_s > 0 && now - last_summary >= interval)
+        {
+            IngestTotals current = totals();
+            double seconds = chrono::duration<double>(now - last_summary).count();
+            bool dropped = current.kernel_drops != before.kernel_drops || current.backlog_drops != before.backlog_drops ||
+                           current.store_drops != before.store_drops || current.wal_drops != before.wal_drops;
+            logger.log(dropped ? LogLevel::Warn : LogLevel::Info, summaryLine(current, before, seconds));
+            before = move(current);
+            last_summary = now;
+        }
+    }
+}
+
+void StatsServer::serveClient()
+{
+    int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1)
+    {
+        return;
+    }
+
+    // A client that does not read must not hold up the summaries for long
+    timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    string text = metricsText();
+    size_t written = 0;
+    while (written < text.size())
+    {
+        ssize_t n = send(client, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    close(client);
+}
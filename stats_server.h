@@ -0,0 +1,82 @@
+#ifndef STATS_SERVER_H
+#define STATS_SERVER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ingest_worker.h"
+#include "latency_histogram.h"
+#include "logger.h"
+#include "report_scheduler.h"
+
+struct StatsOptions
+{
+    std::string socket_path;    // Unix socket serving the metrics; empty disables
+    int summary_interval_s = 0; // Log a one-line summary this often; 0 disables
+};
+
+// Everything the workers count, summed over them
+struct IngestTotals
+{
+    uint64_t received = 0;
+    uint64_t bytes = 0;
+    uint64_t stored = 0;
+    uint64_t parse_errors = 0;
+    uint64_t envelope_errors = 0;
+    uint64_t truncated = 0;
+    uint64_t kernel_drops = 0;
+    uint64_t backlog_drops = 0;
+    uint64_t queue_depth = 0;
+    uint64_t store_bytes = 0;
+    uint64_t store_drops = 0; // Refused, discarded or sampled out at the memory limit
+    uint64_t spilled = 0;
+    uint64_t wal_drops = 0;  // Not logged while WAL writes were failing
+    LatencyHistogram ingest_latency;
+};
+
+// Read-only view of the server's counters for monitoring. The workers only
+// ever bump their own relaxed atomics, so reading them here costs the hot
+// path nothing. One thread serves the current metrics, as plain text with
+// one "name{labels} value" line each, to every client that connects to the
+// Unix socket (e.g. `socat - UNIX-CONNECT:path`), and logs a summary of the
+// last interval (rates, drops, errors, receive-to-stored latency), as a
+// warning when anything was dropped.
+class StatsServer
+{
+public:
+    StatsServer(const std::vector<std::unique_ptr<IngestWorker>> &workers, const ReportScheduler &reports,
+                Logger &logger, const StatsOptions &options);
+    ~StatsServer();
+
+    StatsServer(const StatsServer &) = delete;
+    StatsServer &operator=(const StatsServer &) = delete;
+
+    // Binds the socket (replacing a stale one) and starts the thread if
+    // anything is enabled. Returns false on failure.
+    bool start();
+
+    // Joins the thread and removes the socket
+    void stop();
+
+    IngestTotals totals() const;
+
+    // The metrics as served on the socket
+    std::string metricsText() const;
+
+private:
+    const std::vector<std::unique_ptr<IngestWorker>> &workers;
+    const ReportScheduler &reports;
+    Logger &logger;
+    StatsOptions options;
+    int listen_fd;
+    int stop_fd;
+    std::thread thread;
+
+    void run();
+    void serveClient();
+    std::string summaryLine(const IngestTotals &now, const IngestTotals &before, double seconds) const;
+};
+
+#endif
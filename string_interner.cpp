@@ -0,0 +1,141 @@
+#include "string_interner.h"
+
+#include <cstring>
+#include <functional>
+
+using namespace std;
+
+static const size_t INITIAL_SLOTS = 1024;
+
+StringInterner::Table::Table(size_t capacity)
+    : mask(capacity - 1), slots(new atomic<const Entry *>[capacity])
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        slots[i].store(nullptr, memory_order_relaxed);
+    }
+}
+
+StringInterner::StringInterner(size_t max_strings)
+    : max_strings(max_strings), count(0)
+{
+    tables.emplace_back(new Table(INITIAL_SLOTS));
+    table.store(tables.back().get(), memory_order_release);
+}
+
+uint64_t StringInterner::hashOf(string_view text)
+{
+    return hash<string_view>()(text);
+}
+
+// Linear probing; the table is never more than half full, so an empty slot
+// always ends the search
+const StringInterner::Entry *StringInterner::lookup(const Table &table, uint64_t hash, string_view text)
+{
+    for (size_t i = hash & table.mask;; i = (i + 1) & table.mask)
+    {
+        const Entry *entry = table.slots[i].load(memory_order_acquire);
+        if (entry == nullptr)
+        {
+            return nullptr;
+        }
+        if (entry->hash == hash && entry->length == text.size() && memcmp(entry->text, text.data(), text.size()) == 0)
+        {
+            return entry;
+        }
+    }
+}
+
+void StringInterner::place(Table &table, const Entry *entry)
+{
+    size_t i = entry->hash & table.mask;
+    while (table.slots[i].load(memory_order_relaxed) != nullptr)
+    {
+        i = (i + 1) & table.mask;
+    }
+    table.slots[i].store(entry, memory_order_release);
+}
+
+uint32_t StringInterner::find(string_view text) const
+{
+    string_view canonical;
+    return find(text, canonical);
+}
+
+uint32_t StringInterner::find(string_view text, string_view &canonical) const
+{
+    const Entry *entry = lookup(*table.load(memory_order_acquire), hashOf(text), text);
+    if (entry == nullptr)
+    {
+        return NONE;
+    }
+    canonical = string_view(entry->text, entry->length);
+    return entry->id;
+}
+
+uint32_t StringInterner::intern(string_view text, string_view &canonical)
+{
+    uint64_t hash = hashOf(text);
+    const Entry *entry = lookup(*table.load(memory_order_acquire), hash, text);
+    if (entry == nullptr)
+    {
+        // Full for good: no point waiting for the lock just to find out
+        if (max_strings > 0 && count.load(memory_order_acquire) >= max_strings)
+        {
+            return NONE;
+        }
+        lock_guard<mutex> lock(insert_mutex);
+
+        // Another thread may have inserted it, possibly into a newer table
+        Table *current = tables.back().get();
+        entry = lookup(*current, hash, text);
+        if (entry == nullptr)
+        {
+            if ((max_strings > 0 && entries.size() >= max_strings) || entries.size() >= NONE)
+            {
+                return NONE;
+            }
+            if ((entries.size() + 1) * 2 > current->mask + 1)
+            {
+                // Readers of the old table keep using it until they reload
+                tables.emplace_back(new Table((current->mask + 1) * 2));
+                current = tables.back().get();
+                for (const Entry *old : entries)
+                {
+                    place(*current, old);
+                }
+                table.store(current, memory_order_release);
+            }
+
+            Entry *added = reinterpret_cast<Entry *>(arena.allocate(sizeof(Entry), alignof(Entry)));
+            added->hash = hash;
+            added->text = arena.copy(text).data();
+            added->length = static_cast<uint32_t>(text.size());
+            added->id = static_cast<uint32_t>(entries.size());
+            entries.push_back(added);
+            place(*current, added);
+            count.store(entries.size(), memory_order_release);
+            entry = added;
+        }
+    }
+    canonical = string_view(entry->text, entry->length);
+    return entry->id;
+}
+
+string_view StringInterner::text(uint32_t id) const
+{
+    lock_guard<mutex> lock(insert_mutex);
+    const Entry *entry = entries[id];
+    return string_view(entry->text, entry->length);
+}
+
+size_t StringInterner::bytes() const
+{
+    lock_guard<mutex> lock(insert_mutex);
+    size_t total = arena.bytesReserved() + entries.capacity() * sizeof(Entry *);
+    for (const auto &t : tables)
+    {
+        total += (t->mask + 1) * sizeof(atomic<const Entry *>);
+    }
+    return total;
+}
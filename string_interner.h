@@ -0,0 +1,83 @@
+#ifndef STRING_INTERNER_H
+#define STRING_INTERNER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "record.h"
+
+// Concurrent table of distinct strings. Each string is stored once and gets a
+// dense id (0, 1, 2, ... in insertion order), so repeated record values cost
+// a view (or an id) per record instead of a copy. Lookups of known strings
+// take no lock: the table is open-addressed and insert-only, new entries are
+// published with a release store, and when it grows the old table stays
+// alive for readers still probing it. Inserts are serialized, which is cheap
+// as long as distinct values are rare next to repeated ones: callers stop
+// inserting values that do not repeat (see RecordParser), and once the table
+// is full a miss returns without taking the lock.
+class StringInterner
+{
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    // At most max_strings distinct strings (0: no limit), so that a field
+    // with unbounded distinct values cannot grow the table forever
+    explicit StringInterner(size_t max_strings = 0);
+
+    StringInterner(const StringInterner &) = delete;
+    StringInterner &operator=(const StringInterner &) = delete;
+
+    // Sets canonical to the stored copy of text (valid for the interner's
+    // lifetime) and returns its id, or NONE when the table is full. Thread-safe.
+    uint32_t intern(std::string_view text, std::string_view &canonical);
+
+    // Id of text, or NONE. Thread-safe, lock-free.
+    uint32_t find(std::string_view text) const;
+
+    // Likewise, setting canonical to the stored copy when found
+    uint32_t find(std::string_view text, std::string_view &canonical) const;
+
+    // Text of an id returned earlier. Thread-safe.
+    std::string_view text(uint32_t id) const;
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+
+    // Bytes of text and table, for memory accounting
+    size_t bytes() const;
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        const char *text;
+        uint32_t length;
+        uint32_t id;
+    };
+
+    struct Table
+    {
+        size_t mask;
+        std::unique_ptr<std::atomic<const Entry *>[]> slots;
+
+        explicit Table(size_t capacity);
+    };
+
+    size_t max_strings;
+    std::atomic<const Table *> table;
+    std::atomic<size_t> count;
+
+    mutable std::mutex insert_mutex; // Guards everything below
+    std::vector<std::unique_ptr<Table>> tables; // The current one and every retired one
+    std::vector<const Entry *> entries;        // By id
+    Arena arena;                               // Entries and their text
+
+    static uint64_t hashOf(std::string_view text);
+    static const Entry *lookup(const Table &table, uint64_t hash, std::string_view text);
+    static void place(Table &table, const Entry *entry);
+};
+
+#endif
@@ -0,0 +1,529 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "ingest_worker.h"
+#include "latency_histogram.h"
+#include "string_interner.h"
+
+using json = nlohmann::ordered_json;
+using namespace std;
+
+// Every datagram is one record whose data member starts with the send time
+static const char PAYLOAD_PREFIX[] = "{\"cmd_name\":\"bench\",\"status\":\"OK\",\"data\":\"";
+static const char PAYLOAD_SUFFIX[] = "\"}";
+static const size_t STAMP_DIGITS = 20;
+
+struct BenchOptions
+{
+    int workers = 1;           // Ingestion shards started in this process
+    int senders = 1;           // Sending threads, one socket each
+    uint64_t rate = 0;         // Datagrams per second over all senders; 0 sends as fast as possible
+    int duration_s = 5;
+    size_t batch = 32;         // Datagrams per sendmmsg call
+    size_t payload_min = 128;  // Datagram sizes are uniform in [payload_min, payload_max]
+    size_t payload_max = 1024;
+    int malformed_pct = 0;     // Share of datagrams corrupted so the server rejects them
+    uint16_t port = 12345;
+    std::string target;        // Send to a running server instead of in-process workers
+    std::string wal_dir;       // Defaults to a temporary directory, removed afterwards
+    std::string output;        // JSON results; stdout when empty
+};
+
+struct SenderResult
+{
+    uint64_t sent = 0;
+    uint64_t bytes = 0;
+    uint64_t send_errors = 0;
+    uint64_t malformed = 0; // Of sent
+};
+
+// Written only by its worker's parse thread; read after join()
+struct WorkerProbe
+{
+    LatencyHistogram latency;
+    uint64_t last_stored_ns = 0;
+};
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static void write_stamp(char *out, uint64_t value)
+{
+    for (size_t i = STAMP_DIGITS; i-- > 0;)
+    {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+}
+
+static bool read_stamp(string_view text, uint64_t &value)
+{
+    if (text.size() < STAMP_DIGITS)
+    {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < STAMP_DIGITS; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + static_cast<uint64_t>(text[i] - '0');
+    }
+    return true;
+}
+
+// Kernel receive-queue drops of every UDP socket bound to port, from
+// /proc/net/udp (the last column)
+static uint64_t kernel_drops(uint16_t port)
+{
+    ifstream in("/proc/net/udp");
+    string line;
+    getline(in, line); // Header
+    uint64_t total = 0;
+    while (getline(in, line))
+    {
+        unsigned slot, local_ip, local_port;
+        if (sscanf(line.c_str(), " %u: %x:%x", &slot, &local_ip, &local_port) != 3 || local_port != port)
+        {
+            continue;
+        }
+        size_t last = line.find_last_not_of(" \n");
+        size_t start = line.find_last_of(' ', last);
+        total += strtoull(line.c_str() + start + 1, nullptr, 10);
+    }
+    return total;
+}
+
+static void run_sender(int id, const BenchOptions &options, const sockaddr_in &target, uint64_t start_ns,
+                       uint64_t end_ns, SenderResult &result)
+{
+    int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0 || connect(sockfd, reinterpret_cast<const sockaddr *>(&target), sizeof(target)) < 0)
+    {
+        cerr << "Failed to open sender socket: " << strerror(errno) << endl;
+        if (sockfd >= 0)
+        {
+            close(sockfd);
+        }
+        return;
+    }
+
+    // Payloads are built up front; only their send times change
+    const size_t pool_size = max<size_t>(options.batch, 256);
+    const size_t prefix = sizeof(PAYLOAD_PREFIX) - 1;
+    const size_t suffix = sizeof(PAYLOAD_SUFFIX) - 1;
+    mt19937 random(static_cast<unsigned>(id) + 1);
+    uniform_int_distribution<size_t> size_of(options.payload_min, options.payload_max);
+    vector<string> payloads(pool_size);
+    vector<bool> malformed(pool_size);
+    for (size_t k = 0; k < pool_size; ++k)
+    {
+        string &payload = payloads[k];
+        payload.assign(size_of(random), 'x');
+        memcpy(&payload[0], PAYLOAD_PREFIX, prefix);
+        memcpy(&payload[payload.size() - suffix], PAYLOAD_SUFFIX, suffix);
+
+        // Spread over the pool, each with one of three common defects
+        malformed[k] = static_cast<int>(k % 100) < options.malformed_pct;
+        if (malformed[k])
+        {
+            switch (k % 3)
+            {
+            case 0:
+                payload.back() = ' '; // Unbalanced
+                break;
+            case 1:
+                payload[payload.find("bench")] = '\xFF'; // Invalid UTF-8
+                break;
+            default:
+                payload[0] = '['; // Not an object
+                break;
+            }
+        }
+    }
+
+    vector<iovec> iovecs(options.batch);
+    vector<mmsghdr> messages(options.batch);
+    vector<bool> batch_malformed(options.batch);
+    const double rate = static_cast<double>(options.rate) / options.senders;
+    size_t next_payload = 0;
+    uint64_t now = monotonic_ns();
+    while (now < end_ns)
+    {
+        // Paced against the start, so a late batch is made up by the next ones
+        if (rate > 0)
+        {
+            uint64_t due = start_ns + static_cast<uint64_t>(result.sent * 1e9 / rate);
+            if (due > now)
+            {
+                this_thread::sleep_for(chrono::nanoseconds(due - now));
+            }
+        }
+
+        uint64_t stamp = monotonic_ns();
+        for (size_t i = 0; i < options.batch; ++i)
+        {
+            string &payload = payloads[next_payload];
+            batch_malformed[i] = malformed[next_payload];
+            next_payload = (next_payload + 1) % pool_size;
+            write_stamp(&payload[prefix], stamp);
+            iovecs[i].iov_base = &payload[0];
+            iovecs[i].iov_len = payload.size();
+            memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = sendmmsg(sockfd, messages.data(), static_cast<unsigned>(options.batch), 0);
+        if (n < 0)
+        {
+            result.send_errors++;
+        }
+        else
+        {
+            result.sent += static_cast<uint64_t>(n);
+            for (int i = 0; i < n; ++i)
+            {
+                result.bytes += messages[i].msg_len;
+                result.malformed += batch_malformed[i];
+            }
+        }
+        now = monotonic_ns();
+    }
+    close(sockfd);
+}
+
+// Command line: ./udp_bench [--workers N] [--senders N] [--rate PPS] [--duration-s N]
+//                           [--batch N] [--payload MIN-MAX] [--port N] [--target HOST]
+//                           [--wal-dir DIR] [--malformed PCT] [--output FILE]
+static bool parse_options(int argc, char *argv[], BenchOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            cerr << "Missing value for " << arg << endl;
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--workers")
+        {
+            options.workers = atoi(value);
+        }
+        else if (arg == "--senders")
+        {
+            options.senders = atoi(value);
+        }
+        else if (arg == "--rate")
+        {
+            options.rate = strtoull(value, nullptr, 10);
+        }
+        else if (arg == "--duration-s")
+        {
+            options.duration_s = atoi(value);
+        }
+        else if (arg == "--batch")
+        {
+            options.batch = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--payload")
+        {
+            // A size, or a range to draw sizes from
+            char *dash = nullptr;
+            options.payload_min = strtoull(value, &dash, 10);
+            options.payload_max = *dash == '-' ? strtoull(dash + 1, nullptr, 10) : options.payload_min;
+        }
+        else if (arg == "--port")
+        {
+            options.port = static_cast<uint16_t>(atoi(value));
+        }
+        else if (arg == "--target")
+        {
+            options.target = value;
+        }
+        else if (arg == "--wal-dir")
+        {
+            options.wal_dir = value;
+        }
+        else if (arg == "--malformed")
+        {
+            options.malformed_pct = atoi(value);
+        }
+        else if (arg == "--output")
+        {
+            options.output = value;
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--workers N] [--senders N] [--rate PPS] [--duration-s N] [--batch N]"
+                 << " [--payload MIN-MAX] [--port N] [--target HOST] [--wal-dir DIR] [--malformed PCT]"
+                 << " [--output FILE]" << endl;
+            return false;
+        }
+    }
+    const size_t smallest = sizeof(PAYLOAD_PREFIX) - 1 + STAMP_DIGITS + sizeof(PAYLOAD_SUFFIX) - 1;
+    if (options.workers <= 0 || options.senders <= 0 || options.duration_s <= 0 || options.batch == 0 ||
+        options.batch > 1024 || options.payload_min < smallest || options.payload_max < options.payload_min ||
+        options.payload_max > 65507 || options.port == 0 || options.malformed_pct < 0 || options.malformed_pct > 100)
+    {
+        cerr << "Invalid options (payloads must be " << smallest << " to 65507 bytes, batches at most 1024).\n";
+        return false;
+    }
+    return true;
+}
+
+static double fraction(uint64_t part, uint64_t whole)
+{
+    return whole > 0 ? static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    if (!parse_options(argc, argv, options))
+    {
+        return -1;
+    }
+
+    sockaddr_in target;
+    memset(&target, 0, sizeof(target));
+    target.sin_family = AF_INET;
+    target.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.target.empty() ? "127.0.0.1" : options.target.c_str(), &target.sin_addr) != 1)
+    {
+        cerr << "Invalid target address " << options.target << endl;
+        return -1;
+    }
+
+    // In-process shards, the same pipeline as the server minus record logging; a
+    // hook on each parse thread measures send-to-stored latency
+    const bool in_process = options.target.empty();
+    const bool temporary_wal = in_process && options.wal_dir.empty();
+    if (temporary_wal)
+    {
+        char pattern[] = "/tmp/udp-bench-XXXXXX";
+        if (mkdtemp(pattern) == nullptr)
+        {
+            cerr << "Failed to create a WAL directory: " << strerror(errno) << endl;
+            return -1;
+        }
+        options.wal_dir = pattern;
+    }
+
+    LogOptions log_options;
+    log_options.record_sample = 0;
+    Logger logger(log_options);
+    vector<unique_ptr<WorkerProbe>> probes;
+    StringInterner interner(1 << 20);
+    vector<unique_ptr<IngestWorker>> workers;
+    if (in_process)
+    {
+        logger.start();
+        WorkerOptions worker_options;
+        worker_options.interner = &interner;
+        worker_options.wal.directory = options.wal_dir;
+        for (int i = 0; i < options.workers; ++i)
+        {
+            probes.emplace_back(new WorkerProbe());
+        }
+        worker_options.on_stored = [&probes](int worker, const Record &record)
+        {
+            uint64_t sent_ns;
+            if (read_stamp(record[Record::DATA].str(), sent_ns))
+            {
+                uint64_t now = monotonic_ns();
+                WorkerProbe &probe = *probes[worker];
+                probe.latency.record(now > sent_ns ? now - sent_ns : 0);
+                probe.last_stored_ns = now;
+            }
+        };
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 0; i < options.workers; ++i)
+        {
+            workers.emplace_back(new IngestWorker(i, options.port, logger, worker_options));
+            if (!workers[i]->start(cpus > 0 ? static_cast<int>(i % cpus) : -1))
+            {
+                cerr << "Failed to start worker " << i << ".\n";
+                return -1;
+            }
+        }
+    }
+    const uint64_t drops_before = kernel_drops(options.port);
+
+    vector<SenderResult> results(options.senders);
+    vector<thread> senders;
+    const uint64_t start_ns = monotonic_ns();
+    const uint64_t end_ns = start_ns + static_cast<uint64_t>(options.duration_s) * 1000000000ull;
+    for (int i = 0; i < options.senders; ++i)
+    {
+        senders.emplace_back(run_sender, i, cref(options), cref(target), start_ns, end_ns, ref(results[i]));
+    }
+    for (auto &sender : senders)
+    {
+        sender.join();
+    }
+    const uint64_t send_ns = monotonic_ns() - start_ns;
+
+    SenderResult total;
+    for (const auto &result : results)
+    {
+        total.sent += result.sent;
+        total.bytes += result.bytes;
+        total.send_errors += result.send_errors;
+        total.malformed += result.malformed;
+    }
+
+    // Let the shards drain what is still queued: until every datagram is
+    // accounted for, or nothing has moved for a while
+    uint64_t received = 0;
+    if (in_process)
+    {
+        uint64_t last_progress = monotonic_ns();
+        while (monotonic_ns() - last_progress < 500000000ull)
+        {
+            uint64_t now_received = 0;
+            uint64_t pool_drops = 0;
+            for (const auto &worker : workers)
+            {
+                now_received += worker->counters().received.load(memory_order_relaxed);
+                pool_drops += worker->backlogDrops();
+            }
+            if (now_received != received)
+            {
+                received = now_received;
+                last_progress = monotonic_ns();
+            }
+            if (received + pool_drops + kernel_drops(options.port) - drops_before >= total.sent)
+            {
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        for (auto &worker : workers)
+        {
+            worker->stop();
+        }
+        for (auto &worker : workers)
+        {
+            worker->join();
+        }
+    }
+    // Read while the shard sockets are still open
+    const uint64_t kernel_dropped = kernel_drops(options.port) - drops_before;
+
+    json report;
+    report["benchmark"] = "udp_ingest";
+    report["config"] = {{"workers", in_process ? options.workers : 0},
+                        {"senders", options.senders},
+                        {"rate", options.rate},
+                        {"duration_s", options.duration_s},
+                        {"batch", options.batch},
+                        {"payload_min", options.payload_min},
+                        {"payload_max", options.payload_max},
+                        {"malformed_pct", options.malformed_pct},
+                        {"target", in_process ? "in-process" : options.target}};
+
+    json &out = report["results"];
+    const double send_s = static_cast<double>(send_ns) / 1e9;
+    out["sent"] = total.sent;
+    out["sent_bytes"] = total.bytes;
+    out["send_errors"] = total.send_errors;
+    out["malformed_sent"] = total.malformed;
+    out["sent_pps"] = static_cast<double>(total.sent) / send_s;
+    out["sent_mbps"] = static_cast<double>(total.bytes) * 8 / 1e6 / send_s;
+    out["kernel_drops"] = kernel_dropped;
+    out["kernel_drop_rate"] = fraction(kernel_dropped, total.sent);
+    if (in_process)
+    {
+        uint64_t stored = 0;
+        uint64_t parse_errors = 0;
+        uint64_t rejected[REJECT_REASONS] = {};
+        uint64_t dropped = 0;
+        LatencyHistogram latency;
+        uint64_t last_stored_ns = start_ns;
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            const WorkerCounters &c = workers[i]->counters();
+            stored += c.stored;
+            parse_errors += c.parse_errors;
+            for (size_t r = 0; r < REJECT_REASONS; ++r)
+            {
+                rejected[r] += c.rejected[r];
+            }
+            dropped += workers[i]->backlogDrops();
+            latency.merge(probes[i]->latency);
+            last_stored_ns = max(last_stored_ns, probes[i]->last_stored_ns);
+        }
+        const double ingest_s = static_cast<double>(last_stored_ns - start_ns) / 1e9;
+        out["received"] = received;
+        out["stored"] = stored;
+        out["stored_pps"] = ingest_s > 0 ? static_cast<double>(stored) / ingest_s : 0.0;
+        out["app_drops"] = dropped;
+        out["app_drop_rate"] = fraction(dropped, total.sent);
+        out["parse_errors"] = parse_errors;
+        out["rejected"] = json::object();
+        for (size_t r = 1; r < REJECT_REASONS; ++r)
+        {
+            if (rejected[r] > 0)
+            {
+                out["rejected"][reject_reason_name(static_cast<RejectReason>(r))] = rejected[r];
+            }
+        }
+        // Malformed datagrams are meant to be rejected, not stored
+        const uint64_t valid = total.sent - total.malformed;
+        out["lost"] = valid > stored ? valid - stored : 0;
+        out["loss_rate"] = fraction(valid > stored ? valid - stored : 0, valid);
+        out["latency_us"] = {{"p50", latency.percentile(0.50) / 1e3},
+                             {"p99", latency.percentile(0.99) / 1e3},
+                             {"p999", latency.percentile(0.999) / 1e3},
+                             {"max", latency.max() / 1e3}};
+    }
+
+    workers.clear();
+    if (in_process)
+    {
+        logger.stop();
+    }
+    if (temporary_wal)
+    {
+        error_code ignored;
+        filesystem::remove_all(options.wal_dir, ignored);
+    }
+
+    if (options.output.empty())
+    {
+        cout << report.dump(2) << endl;
+    }
+    else
+    {
+        ofstream file(options.output);
+        file << report.dump(2) << endl;
+        if (!file)
+        {
+            cerr << "Failed to write " << options.output << endl;
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -1,152 +1,403 @@
 #include <iostream>
-#include <fstream>
 #include <csignal>
 #include <cstring>
-#include <sys/socket.h>
-#include <arpa/inet.h>
+#include <sys/signalfd.h>
 #include <unistd.h>
-#include <nlohmann/json.hpp>
 #include <vector>
-#include <sys/wait.h> // Include for wait
-#include <fcntl.h>    // For fcntl to make socket non-blocking
-
-using json = nlohmann::json;
+#include <memory>
+#include <pthread.h>
+#include "ingest_worker.h"
+#include "report_scheduler.h"
+#include "stats_server.h"
+#include "string_interner.h"
 
 using namespace std;
 
-vector<json> received_data;
-bool running = true;
+struct ServerOptions
+{
+    int workers = 0;
+    size_t intern_max = 1 << 20;
+    size_t store_max_bytes = 0; // Split evenly between the workers
+    WorkerOptions worker;
+    ReportOptions report;
+    StatsOptions stats;
+    LogOptions log;
+};
 
-// Signal handler for Ctrl+C (SIGINT)
-void signal_handler(int signal)
+// Command line: ./server [--workers N] [--max-datagram BYTES] [--pool-buffers N]
+//                        [--reassembly-timeout-ms N] [--reassembly-max-mb N]
+//                        [--wal-dir DIR] [--wal-segment-mb N]
+//                        [--wal-sync-ms N] [--wal-sync-records N] [--wal-retention-h N]
+//                        [--report-interval-s N] [--report-every N]
+//                        [--report-summary off|first|only] [--quiet]
+//                        [--stats-socket PATH] [--stats-interval-s N]
+//                        [--log-level LEVEL] [--log-sample N]
+//                        [--log-records-per-s N] [--log-errors-per-s N] [--intern-max N]
+//                        [--store-max-mb N] [--spill-dir DIR] [--spill-after-s N]
+//                        [--overload drop-newest|drop-oldest|sample] [--sample-every N]
+//                        [--max-record-bytes N] [--max-depth N] [--require-keys KEY,...]
+// Without --workers, one shard per online CPU. --quiet stops logging received
+// records. SIGUSR1 writes a report without stopping the server.
+bool parse_options(int argc, char *argv[], ServerOptions &options)
 {
-    if (signal == SIGINT)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options.workers = cpus > 0 ? static_cast<int>(cpus) : 1;
+    for (int i = 1; i < argc; ++i)
     {
-        cout << "\nCtrl+C pressed. Saving data to data.json...\n";
-
-        // Open the file for writing
-        ofstream file("data.json");
-        if (file.is_open())
+        string arg = argv[i];
+        if (arg == "--quiet")
+        {
+            options.log.record_sample = 0;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            cerr << "Missing value for " << arg << endl;
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--workers")
+        {
+            options.workers = atoi(value);
+        }
+        else if (arg == "--max-datagram")
+        {
+            options.worker.max_datagram = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--pool-buffers")
+        {
+            options.worker.pool_buffers = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--reassembly-timeout-ms")
+        {
+            options.worker.reassembly.timeout_ms = atoi(value);
+        }
+        else if (arg == "--reassembly-max-mb")
+        {
+            options.worker.reassembly.max_pending_bytes = static_cast<size_t>(atol(value)) * 1024 * 1024;
+        }
+        else if (arg == "--wal-dir")
+        {
+            options.worker.wal.directory = value;
+        }
+        else if (arg == "--wal-segment-mb")
+        {
+            options.worker.wal.segment_bytes = static_cast<size_t>(atol(value)) * 1024 * 1024;
+        }
+        else if (arg == "--wal-sync-ms")
+        {
+            options.worker.wal.sync_interval_ms = atoi(value);
+        }
+        else if (arg == "--wal-sync-records")
+        {
+            options.worker.wal.sync_records = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--wal-retention-h")
+        {
+            options.worker.wal.retention_s = atoi(value) * 3600;
+        }
+        else if (arg == "--report-interval-s")
+        {
+            options.report.interval_s = atoi(value);
+        }
+        else if (arg == "--report-every")
+        {
+            options.report.every_records = static_cast<uint64_t>(atoll(value));
+        }
+        else if (arg == "--report-summary")
+        {
+            if (!parse_summary_mode(value, options.report.summary))
+            {
+                cerr << "Unknown summary mode: " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--log-level")
+        {
+            if (!parse_log_level(value, options.log.level))
+            {
+                cerr << "Unknown log level " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--log-sample")
+        {
+            options.log.record_sample = static_cast<uint32_t>(atol(value));
+        }
+        else if (arg == "--log-records-per-s")
+        {
+            options.log.records_per_s = atof(value);
+        }
+        else if (arg == "--log-errors-per-s")
+        {
+            options.log.errors_per_s = atof(value);
+        }
+        else if (arg == "--store-max-mb")
+        {
+            options.store_max_bytes = static_cast<size_t>(atol(value)) * 1024 * 1024;
+        }
+        else if (arg == "--spill-dir")
+        {
+            options.worker.store.spill_dir = value;
+        }
+        else if (arg == "--spill-after-s")
+        {
+            options.worker.store.spill_after_s = atoi(value);
+        }
+        else if (arg == "--overload")
+        {
+            if (!parse_overload_policy(value, options.worker.store.policy))
+            {
+                cerr << "Unknown overload policy: " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--sample-every")
+        {
+            options.worker.store.sample_every = static_cast<uint32_t>(atol(value));
+        }
+        else if (arg == "--max-record-bytes")
+        {
+            options.worker.scan.max_bytes = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--max-depth")
+        {
+            options.worker.scan.max_depth = static_cast<size_t>(atol(value));
+        }
+        else if (arg == "--require-keys")
         {
-            file << "[\n";
-            for (size_t i = 0; i < received_data.size(); ++i)
+            options.worker.scan.required_keys.clear();
+            string keys = value;
+            for (size_t start = 0; start <= keys.size();)
             {
-                file << received_data[i].dump(4);
-                if (i != received_data.size() - 1)
+                size_t comma = keys.find(',', start);
+                if (comma == string::npos)
+                {
+                    comma = keys.size();
+                }
+                if (comma > start)
                 {
-                    file << ",\n";
+                    options.worker.scan.required_keys.push_back(keys.substr(start, comma - start));
                 }
+                start = comma + 1;
             }
-            file << "\n]";
-            file.close();
-            cout << "Data saved to data.json successfully.\n";
         }
-        else
+        else if (arg == "--intern-max")
         {
-            cerr << "Failed to open data.json for writing.\n";
+            options.intern_max = static_cast<size_t>(atol(value));
         }
-
-        // Run the generate_files command
-        if (fork() == 0)
-        { // Create a new process
-            execlp("./generate_files", "generate_files", "data.json", "output.pdf", nullptr);
-            // If execlp fails
-            cerr << "Failed to execute generate_files.\n";
-            exit(1);
+        else if (arg == "--stats-socket")
+        {
+            options.stats.socket_path = value;
+        }
+        else if (arg == "--stats-interval-s")
+        {
+            options.stats.summary_interval_s = atoi(value);
         }
         else
         {
-            wait(nullptr); // Wait for the child process to finish
+            cerr << "Usage: " << argv[0] << " [--workers N] [--max-datagram BYTES] [--pool-buffers N]"
+                 << " [--reassembly-timeout-ms N] [--reassembly-max-mb N] [--wal-dir DIR] [--wal-segment-mb N]"
+                 << " [--wal-sync-ms N] [--wal-sync-records N] [--wal-retention-h N] [--report-interval-s N] [--report-every N]"
+                 << " [--report-summary off|first|only] [--quiet] [--stats-socket PATH] [--stats-interval-s N]"
+                 << " [--log-level debug|info|warn|error|off]"
+                 << " [--log-sample N] [--log-records-per-s N] [--log-errors-per-s N] [--intern-max N]"
+                 << " [--store-max-mb N] [--spill-dir DIR] [--spill-after-s N]"
+                 << " [--overload drop-newest|drop-oldest|sample] [--sample-every N]"
+                 << " [--max-record-bytes N] [--max-depth N] [--require-keys KEY,...]" << endl;
+            return false;
         }
-
-        running = false; // Stop the main loop
     }
+    if (options.workers <= 0 || options.worker.max_datagram == 0 || options.worker.pool_buffers < ReceiveEngine::BATCH_SIZE ||
+        options.worker.wal.segment_bytes == 0 || options.worker.wal.sync_interval_ms < 0 || options.worker.wal.retention_s < 0 ||
+        options.report.interval_s < 0 || options.stats.summary_interval_s < 0 || options.log.records_per_s < 0 ||
+        options.log.errors_per_s < 0 || options.worker.store.spill_after_s < 0 || options.worker.store.sample_every == 0 ||
+        options.worker.scan.max_depth == 0 || options.worker.scan.max_depth > 64 ||
+        options.worker.scan.required_keys.size() > 64)
+    {
+        cerr << "Invalid options.\n";
+        return false;
+    }
+    options.worker.store.memory_limit = options.store_max_bytes / options.workers;
+    return true;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    int sockfd;
-    struct sockaddr_in server_addr, client_addr;
-    char buffer[1024];
-    socklen_t addr_len = sizeof(client_addr);
+    const uint16_t port = 12345;
 
-    // Register signal handler for Ctrl+C
-    signal(SIGINT, signal_handler);
+    ServerOptions options;
+    if (!parse_options(argc, argv, options))
+    {
+        return -1;
+    }
+    int worker_count = options.workers;
 
-    // Create UDP socket
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    // Block SIGINT/SIGTERM/SIGUSR1 before any thread starts so every thread
+    // inherits the mask and the signals are only delivered through the signalfd
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+    {
+        cerr << "Failed to block signals.\n";
+        return -1;
+    }
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (signal_fd == -1)
     {
-        cerr << "Failed to create socket.\n";
+        cerr << "Failed to create signalfd.\n";
         return -1;
     }
 
-    // Set up server address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(12345);
+    // Log output runs on its own thread so a slow terminal cannot stall ingestion
+    Logger logger(options.log);
+    logger.start();
 
-    // Bind the socket to port 12345
-    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    // Repeated values (command names, statuses, ...) are stored once for all
+    // shards; past intern_max distinct values, new ones are copied per record
+    StringInterner interner(options.intern_max);
+    options.worker.interner = &interner;
+
+    vector<unique_ptr<IngestWorker>> workers;
+    for (int i = 0; i < worker_count; ++i)
     {
-        cerr << "Bind failed.\n";
-        close(sockfd);
-        return -1;
+        workers.emplace_back(new IngestWorker(i, port, logger, options.worker));
     }
 
-    // Make the socket non-blocking
-    int flags = fcntl(sockfd, F_GETFL, 0);
-    if (flags == -1)
+    // Recover what earlier runs logged. Segments from shards that no longer
+    // exist (fewer workers than last time) are spread over the current ones.
+    size_t expired = WriteAheadLog::removeExpired(options.worker.wal.directory, options.worker.wal.retention_s);
+    if (expired > 0)
     {
-        cerr << "Failed to get socket flags.\n";
-        close(sockfd);
-        return -1;
+        cout << "Deleted " << expired << " WAL segment(s) past retention\n";
     }
-    if (fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1)
+    vector<vector<string>> replay_paths(worker_count);
+    for (const auto &segment : WriteAheadLog::listSegments(options.worker.wal.directory))
     {
-        cerr << "Failed to set socket to non-blocking.\n";
-        close(sockfd);
-        return -1;
+        replay_paths[segment.shard % worker_count].push_back(segment.path);
+    }
+    for (int i = 0; i < worker_count; ++i)
+    {
+        workers[i]->replay(replay_paths[i]);
+        const WorkerCounters &c = workers[i]->counters();
+        if (c.replayed > 0 || c.torn_lines > 0 || c.skipped_segments > 0)
+        {
+            cout << "Worker " << i << " recovered " << c.replayed << " record(s) from the WAL"
+                 << " (" << c.torn_lines << " torn line(s) skipped, " << c.skipped_segments
+                 << " older segment(s) over the store budget left out)\n";
+        }
+    }
+
+    // One SO_REUSEPORT socket and pinned receive thread per worker
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < worker_count; ++i)
+    {
+        if (!workers[i]->start(cpus > 0 ? static_cast<int>(i % cpus) : -1))
+        {
+            cerr << "Failed to start worker " << i << ".\n";
+            return -1;
+        }
     }
 
-    cout << "UDP server is listening on port 12345 (non-blocking mode)...\n";
+    ReportScheduler reports(workers, options.report);
+    reports.start();
 
-    // Main loop to receive data
-    while (running)
+    StatsServer stats(workers, reports, logger, options.stats);
+    if (!stats.start())
     {
-        memset(buffer, 0, sizeof(buffer));
-        int n = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, (struct sockaddr *)&client_addr, &addr_len);
+        return -1;
+    }
 
-        if (n > 0)
-        {
-            buffer[n] = '\0'; // Null-terminate the buffer
-            string received(buffer);
+    cout << "UDP server is listening on port " << port << " with " << worker_count << " worker(s)...\n";
 
-            try
+    // Write a report on SIGUSR1; stop on Ctrl+C (or SIGTERM)
+    signalfd_siginfo info;
+    while (true)
+    {
+        if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+        {
+            if (errno == EINTR)
             {
-                // Parse received JSON and add to the list
-                json data = json::parse(received);
-                received_data.push_back(data);
-
-                cout << "Received data: " << data.dump(4) << endl;
+                continue;
             }
-            catch (json::parse_error &e)
+            cerr << "Failed to read signalfd.\n";
+            break;
+        }
+        if (info.ssi_signo == SIGUSR1)
+        {
+            reports.request();
+            continue;
+        }
+        if (info.ssi_signo == SIGINT)
+        {
+            cout << "\nCtrl+C pressed.\n";
+        }
+        break;
+    }
+
+    stats.stop();
+    reports.stop();
+    for (auto &worker : workers)
+    {
+        worker->stop();
+    }
+    for (auto &worker : workers)
+    {
+        worker->join();
+    }
+    logger.stop();
+
+    for (const auto &worker : workers)
+    {
+        const WorkerCounters &c = worker->counters();
+        cout << "Worker " << worker->id() << ": received " << c.received << ", stored " << c.stored
+             << ", batched " << c.batched << ", generic parses " << c.generic_parses << ", parse errors "
+             << c.parse_errors << ", envelope errors " << c.envelope_errors << ", truncated " << c.truncated
+             << ", dropped (parser behind) " << worker->backlogDrops() << ", dropped (kernel) "
+             << worker->kernelDrops() << "\n";
+        if (c.parse_errors > 0)
+        {
+            cout << "Worker " << worker->id() << " rejected:";
+            const char *separator = " ";
+            for (size_t r = 1; r < REJECT_REASONS; ++r)
             {
-                cerr << "Error parsing JSON: " << e.what() << endl;
+                if (c.rejected[r] > 0)
+                {
+                    cout << separator << reject_reason_text(static_cast<RejectReason>(r)) << " " << c.rejected[r];
+                    separator = ", ";
+                }
             }
+            cout << "\n";
         }
-        else if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+        const StoreCounters &st = worker->storeCounters();
+        cout << "Worker " << worker->id() << " store: " << st.memory_bytes / (1024 * 1024) << " MiB in memory, spilled "
+             << st.spilled_records << ", dropped (newest) " << st.dropped_newest << ", dropped (oldest) "
+             << st.dropped_oldest << ", sampled out " << st.sampled_out << ", spill failures " << st.spill_failures
+             << "\n";
+        const WalCounters &wc = worker->walCounters();
+        if (wc.write_errors > 0)
         {
-            // Handle error, except for "would block" or "try again" errors (which are expected in non-blocking sockets)
-            cerr << "Error receiving data: " << strerror(errno) << endl;
+            cout << "Worker " << worker->id() << " WAL: " << wc.write_errors << " failed commit(s), dropped "
+                 << wc.dropped_records << "\n";
+        }
+        const ReassemblyCounters &r = worker->reassemblyCounters();
+        if (r.fragments > 0)
+        {
+            cout << "Worker " << worker->id() << " fragments: " << r.fragments << ", reassembled " << r.reassembled
+                 << ", timed out " << r.timeouts << ", evicted " << r.evicted << ", invalid " << r.invalid
+                 << ", duplicates " << r.duplicates << "\n";
         }
-
-        // Small sleep to prevent busy looping when no data is available
-        usleep(100000); // Sleep for 100ms
     }
+    cout << "Interned values: " << interner.size() << " (" << interner.bytes() / 1024 << " KiB)\n";
+    cout << "Log lines dropped: " << logger.dropped() << ", suppressed: " << logger.suppressed() << "\n";
+
+    // Final report with every record, on every core
+    reports.generate(0);
 
-    // Close the socket
-    close(sockfd);
+    close(signal_fd);
 
     cout << "Server has been shut down.\n";
     return 0;
@@ -0,0 +1,332 @@
+#include "write_ahead_log.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const size_t WAL_BUFFER_LIMIT = 1024 * 1024; // Commit early rather than buffer more than this
+
+WriteAheadLog::WriteAheadLog(const WalOptions &options, function<void(const string &)> report)
+    : options(options), shard(0), sequence(0), fd(-1), segment_size(0), pending(0),
+      records_written(0), commit_count(0), report(move(report)), failing(false), dropped_reported(0)
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    close();
+}
+
+static bool parse_segment_name(const string &name, int &shard, int &sequence)
+{
+    char suffix[16];
+    if (sscanf(name.c_str(), "shard-%d-%d.%15s", &shard, &sequence, suffix) != 3)
+    {
+        return false;
+    }
+    return strcmp(suffix, "ndjson") == 0;
+}
+
+vector<WalSegment> WriteAheadLog::listSegments(const string &directory)
+{
+    vector<WalSegment> segments;
+    error_code ec;
+    for (const auto &entry : fs::directory_iterator(directory, ec))
+    {
+        WalSegment segment;
+        if (entry.is_regular_file() && parse_segment_name(entry.path().filename().string(), segment.shard, segment.sequence))
+        {
+            segment.path = entry.path().string();
+            segments.push_back(segment);
+        }
+    }
+    sort(segments.begin(), segments.end(), [](const WalSegment &a, const WalSegment &b)
+         { return a.shard != b.shard ? a.shard < b.shard : a.sequence < b.sequence; });
+    return segments;
+}
+
+size_t WriteAheadLog::removeExpired(const string &directory, int max_age_s, int shard)
+{
+    if (max_age_s <= 0)
+    {
+        return 0;
+    }
+    const auto cutoff = fs::file_time_type::clock::now() - chrono::seconds(max_age_s);
+    size_t removed = 0;
+    for (const auto &segment : listSegments(directory))
+    {
+        error_code ec;
+        if ((shard < 0 || segment.shard == shard) && fs::last_write_time(segment.path, ec) < cutoff && !ec &&
+            fs::remove(segment.path, ec))
+        {
+            removed++;
+        }
+    }
+    return removed;
+}
+
+bool WriteAheadLog::readSegment(const string &path, const function<void(const char *, size_t)> &handler,
+                                uint64_t &torn_lines)
+{
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in == -1)
+    {
+        cerr << "Failed to open WAL segment " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    // Read in chunks and hand out complete lines; a partial line is carried over
+    string chunk;
+    size_t start = 0;
+    vector<char> block(WAL_BUFFER_LIMIT);
+    while (true)
+    {
+        ssize_t n = read(in, block.data(), block.size());
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "Failed to read WAL segment " << path << ": " << strerror(errno) << endl;
+            ::close(in);
+            return false;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+
+        chunk.erase(0, start);
+        start = 0;
+        chunk.append(block.data(), n);
+
+        size_t newline;
+        while ((newline = chunk.find('\n', start)) != string::npos)
+        {
+            if (newline > start)
+            {
+                handler(chunk.data() + start, newline - start);
+            }
+            start = newline + 1;
+        }
+    }
+    ::close(in);
+
+    if (start < chunk.size())
+    {
+        torn_lines++;
+    }
+    return true;
+}
+
+bool WriteAheadLog::open(int shard_id)
+{
+    shard = shard_id;
+
+    error_code ec;
+    fs::create_directories(options.directory, ec);
+    if (ec)
+    {
+        cerr << "Failed to create WAL directory " << options.directory << ": " << ec.message() << endl;
+        return false;
+    }
+
+    // Continue numbering after this shard's existing segments
+    sequence = 0;
+    for (const auto &segment : listSegments(options.directory))
+    {
+        if (segment.shard == shard)
+        {
+            sequence = max(sequence, segment.sequence);
+        }
+    }
+    last_commit = chrono::steady_clock::now();
+    string error;
+    if (!openSegment(error))
+    {
+        cerr << error << endl;
+        return false;
+    }
+    return true;
+}
+
+bool WriteAheadLog::openSegment(string &error)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "shard-%d-%06d.ndjson", shard, ++sequence);
+    path = (fs::path(options.directory) / name).string();
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        error = "Failed to open WAL segment " + path + ": " + strerror(errno);
+        return false;
+    }
+    segment_size = 0;
+
+    // The new segment was just created, so only older ones can go
+    removeExpired(options.directory, options.retention_s, shard);
+    return true;
+}
+
+void WriteAheadLog::append(const Record &record)
+{
+    if (failing && buffer.size() >= options.max_buffer_bytes)
+    {
+        stats.dropped_records.fetch_add(1, memory_order_relaxed);
+        tick();
+        return;
+    }
+    record.appendJson(buffer);
+    buffer += '\n';
+    pending++;
+    records_written++;
+
+    // While writes fail, only the sync interval retries them
+    if (!failing && (pending >= options.sync_records || buffer.size() >= WAL_BUFFER_LIMIT))
+    {
+        commit();
+    }
+    else
+    {
+        tick();
+    }
+}
+
+void WriteAheadLog::tick()
+{
+    if (pending > 0 && chrono::steady_clock::now() - last_commit >= chrono::milliseconds(options.sync_interval_ms))
+    {
+        commit();
+    }
+}
+
+bool WriteAheadLog::commit()
+{
+    last_commit = chrono::steady_clock::now();
+    if (buffer.empty())
+    {
+        return true;
+    }
+    string error;
+    if (fd == -1 && !openSegment(error))
+    {
+        return fail(error); // Rotating failed earlier
+    }
+
+    const char *data = buffer.data();
+    size_t remaining = buffer.size();
+    while (remaining > 0)
+    {
+        ssize_t n = write(fd, data, remaining);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // Keep what is left so the next commit retries it
+            error = string("WAL write failed: ") + strerror(errno);
+            segment_size += buffer.size() - remaining;
+            buffer.erase(0, buffer.size() - remaining);
+            return fail(error);
+        }
+        data += n;
+        remaining -= n;
+    }
+
+    // One sync covers the whole group
+    if (fdatasync(fd) == -1)
+    {
+        error = string("WAL fdatasync failed: ") + strerror(errno);
+    }
+
+    segment_size += buffer.size();
+    buffer.clear();
+    pending = 0;
+    commit_count++;
+
+    if (segment_size >= options.segment_bytes)
+    {
+        ::close(fd);
+        fd = -1;
+        if (error.empty() && !openSegment(error))
+        {
+            return fail(error);
+        }
+    }
+    if (!error.empty())
+    {
+        return fail(error);
+    }
+    if (failing)
+    {
+        failing = false;
+        const uint64_t dropped = stats.dropped_records.load(memory_order_relaxed);
+        string text = "WAL writes succeed again";
+        if (dropped > dropped_reported)
+        {
+            text += " (" + to_string(dropped - dropped_reported) + " record(s) dropped meanwhile)";
+            dropped_reported = dropped;
+        }
+        notify(text);
+    }
+    return true;
+}
+
+// Commits are retried no more often than the sync interval while failing,
+// so this reports at most once per interval
+bool WriteAheadLog::fail(const string &error)
+{
+    failing = true;
+    stats.write_errors.fetch_add(1, memory_order_relaxed);
+    string text = error;
+    const uint64_t dropped = stats.dropped_records.load(memory_order_relaxed);
+    if (dropped > dropped_reported)
+    {
+        text += " (" + to_string(dropped - dropped_reported) + " record(s) dropped, buffer full)";
+        dropped_reported = dropped;
+    }
+    notify(text);
+    return false;
+}
+
+void WriteAheadLog::notify(const string &text)
+{
+    if (report)
+    {
+        report(text);
+    }
+    else
+    {
+        cerr << text << endl;
+    }
+}
+
+void WriteAheadLog::close()
+{
+    if (fd != -1 || !buffer.empty())
+    {
+        commit(); // Also reopens the segment if rotating failed
+    }
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+
+        // Don't leave an empty segment behind for every restart
+        if (segment_size == 0 && buffer.empty())
+        {
+            unlink(path.c_str());
+        }
+    }
+}
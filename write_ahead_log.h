@@ -0,0 +1,114 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "record.h"
+
+struct WalOptions
+{
+    std::string directory = "wal";
+    size_t segment_bytes = 64 * 1024 * 1024; // Rotate once a segment reaches this size
+    int sync_interval_ms = 100;              // Group commit at least this often...
+    size_t sync_records = 4096;              // ...or once this many records are pending
+    size_t max_buffer_bytes = 16 * 1024 * 1024; // Held for retry while writes fail; newer records are dropped
+    int retention_s = 24 * 3600;             // Segments last written longer ago are deleted; 0 keeps them all
+};
+
+struct WalCounters
+{
+    std::atomic<uint64_t> write_errors{0};    // Failed commits (write, sync or opening the next segment)
+    std::atomic<uint64_t> dropped_records{0}; // Not logged because the retry buffer was full
+};
+
+struct WalSegment
+{
+    int shard;
+    int sequence;
+    std::string path;
+};
+
+// Append-only, segmented NDJSON log for one ingestion shard. Records are
+// buffered and made durable in groups (one write + fdatasync per commit),
+// bounded by both time and count. Segments are named
+// shard-<shard>-<sequence>.ndjson and never reopened for writing: a restart
+// always starts a fresh segment, so a torn tail is confined to the last line
+// of an old segment. Segments older than retention_s are deleted on startup
+// (removeExpired) and whenever the shard rotates to a new one.
+//
+// When a commit fails (disk full, I/O error), the pending records are kept
+// and retried once per sync interval rather than on every append; past
+// max_buffer_bytes new records are dropped and counted. Failures are
+// reported through report (at most once per sync interval, and once more
+// when writes succeed again), or to stderr without one.
+class WriteAheadLog
+{
+public:
+    explicit WriteAheadLog(const WalOptions &options, std::function<void(const std::string &)> report = nullptr);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    // Creates the directory if needed and opens a new segment for shard
+    bool open(int shard);
+
+    void append(const Record &record);
+
+    // Commits pending records if the sync interval has elapsed; call this
+    // periodically when no records are arriving
+    void tick();
+
+    // Writes and syncs everything pending
+    bool commit();
+
+    // Commits the tail and closes the current segment
+    void close();
+
+    int syncIntervalMs() const { return options.sync_interval_ms; }
+    uint64_t recordsWritten() const { return records_written; }
+    uint64_t commits() const { return commit_count; }
+
+    // Readable from any thread
+    const WalCounters &counters() const { return stats; }
+
+    // All segments in directory, ordered by shard then sequence
+    static std::vector<WalSegment> listSegments(const std::string &directory);
+
+    // Deletes segments (of shard, or of any shard if it is negative) last
+    // written more than max_age_s ago. Returns how many were deleted.
+    static size_t removeExpired(const std::string &directory, int max_age_s, int shard = -1);
+
+    // Calls handler for every complete line of a segment. A final line
+    // without a newline (a write torn by a crash) is skipped and counted.
+    static bool readSegment(const std::string &path, const std::function<void(const char *, size_t)> &handler,
+                            uint64_t &torn_lines);
+
+private:
+    WalOptions options;
+    int shard;
+    int sequence;
+    int fd;
+    std::string path;
+    size_t segment_size;
+    std::string buffer;
+    size_t pending;
+    std::chrono::steady_clock::time_point last_commit;
+    uint64_t records_written;
+    uint64_t commit_count;
+    std::function<void(const std::string &)> report;
+    bool failing;             // The last commit failed; retry on the sync interval only
+    uint64_t dropped_reported; // Dropped records already mentioned in a report
+    WalCounters stats;
+
+    bool openSegment(std::string &error);
+    bool fail(const std::string &error);
+    void notify(const std::string &text);
+};
+
+#endif